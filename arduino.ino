@@ -4,6 +4,16 @@
 // -------- I2C address (change if you want) --------
 #define I2C_ADDR 0x42
 
+// -------- Data-ready line (host: --i2c-irq) --------
+// Open drain to a Pi GPIO: pulled low while the input frame has changed since the host
+// last read it, released (the Pi's pull-up) by the read. D1 is free as long as Serial
+// is not used; pick a pin outside D2..D13 so it does not show up in the digital mask.
+// -1 disables it (the host then simply polls).
+#define DATA_READY_PIN 1
+// Axis movement (ADC counts) that counts as a change; smaller jitter waits for the
+// host's watchdog poll.
+static const uint16_t AXIS_IRQ_THRESHOLD = 4;
+
 // -------- Battery measurement config --------
 // If using a resistor divider: VBAT -> R_TOP -> A7 -> R_BOTTOM -> GND
 // divider_gain = (R_TOP + R_BOTTOM) / R_BOTTOM
@@ -45,11 +55,17 @@ static inline uint16_t readDigitalMask_D2_to_D13() {
 static volatile uint16_t adcA0, adcA1, adcA2, adcA3, adcA6, adcA7;
 static volatile uint16_t dmask_cache;
 static volatile uint8_t raw_packet[12];
+static volatile uint8_t host_packet[12];  // the packet the host read last
 
 // Battery computed/cache
 static volatile uint16_t vbat_mV = 3700;
 static volatile uint8_t soc_pct = 50;
 
+// -------- Register map --------
+// 0x80 returns the 12-byte input frame (host: --i2c-read register, the default). It is
+// outside the SBS command range, so frame and battery reads on this address never mix.
+#define REG_INPUT_FRAME 0x80
+
 // -------- SBS/SMBus emulation state --------
 static volatile bool sbs_pending = false;
 static volatile uint8_t sbs_cmd = 0xFF;
@@ -75,6 +91,32 @@ static inline uint8_t atomicReadU8(volatile uint8_t *vp) {
   return r;
 }
 
+// -------- Data-ready line --------
+static inline void set_data_ready(bool on) {
+#if DATA_READY_PIN >= 0
+  // Never drive high: the Pi side is 3.3 V.
+  if (on) {
+    digitalWrite(DATA_READY_PIN, LOW);
+    pinMode(DATA_READY_PIN, OUTPUT);
+  } else {
+    pinMode(DATA_READY_PIN, INPUT);
+  }
+#else
+  (void)on;
+#endif
+}
+
+// Called with interrupts off: has `out` moved away from what the host last saw?
+static bool packet_changed_since_read(const uint8_t* out) {
+  if (out[10] != host_packet[10] || out[11] != host_packet[11]) return true;  // digital mask
+  for (uint8_t i = 0; i < 10; i += 2) {
+    int16_t now = (int16_t)(out[i] | ((uint16_t)out[i + 1] << 8));
+    int16_t then = (int16_t)(host_packet[i] | ((uint16_t)host_packet[i + 1] << 8));
+    if (abs(now - then) > (int16_t)AXIS_IRQ_THRESHOLD) return true;
+  }
+  return false;
+}
+
 // -------- Battery math --------
 static inline float adc_to_v(float adc) {
   // 10-bit ADC: 0..1023
@@ -88,7 +130,6 @@ static void refresh_cache() {
   adcA2 = (uint16_t)analogRead(A2);
   adcA3 = (uint16_t)analogRead(A3);
   adcA6 = (uint16_t)analogRead(A6);
-  adcA7 = (uint16_t)analogRead(A7);
 
   dmask_cache = readDigitalMask_D2_to_D13();
 
@@ -103,7 +144,12 @@ static void refresh_cache() {
 
   uint8_t sreg = SREG; cli();
   memcpy((void*)raw_packet, out, sizeof(out));
+  if (packet_changed_since_read(out)) set_data_ready(true);
   SREG = sreg;
+}
+
+static void refresh_battery() {
+  adcA7 = (uint16_t)analogRead(A7);
 
   // Battery voltage from A7:
   // v_a7 = adc_to_v(adcA7)
@@ -123,7 +169,7 @@ static void refresh_cache() {
   uint16_t mv = (uint16_t)(vbat * 1000.0f + 0.5f);
   uint8_t pct = (uint8_t)(soc_ema + 0.5f);
 
-  sreg = SREG; cli();
+  uint8_t sreg = SREG; cli();
   vbat_mV = mv;
   soc_pct = pct;
   SREG = sreg;
@@ -143,6 +189,15 @@ static void writeBlockString(const char *s) {
   Wire.write((const uint8_t*)s, len);
 }
 
+// Sends the current input frame and releases the data-ready line. ISR context.
+static void sendInputFrame() {
+  uint8_t out[12];
+  memcpy(out, (const void*)raw_packet, sizeof(out));
+  memcpy((void*)host_packet, out, sizeof(out));
+  set_data_ready(false);
+  Wire.write(out, sizeof(out));
+}
+
 // -------- I2C callbacks --------
 void onI2CReceive(int n) {
   if (n <= 0) return;
@@ -200,18 +255,14 @@ void onI2CRequest() {
       case 0x21: writeBlockString(MODEL); break;           // DeviceName
       case 0x22: writeBlockString(CHEM);  break;           // DeviceChemistry
       case 0x03: writeWordLE(atomicReadU16(&battery_mode)); break; // BatteryMode
+      case REG_INPUT_FRAME: sendInputFrame(); break;       // input frame (register read)
       default:   writeWordLE(0xFFFF); break;               // Unknown
     }
     return;
   }
 
-  // Otherwise: legacy behavior — raw 12-byte packet
-  uint8_t out[12];
-  uint8_t sreg = SREG; cli();
-  memcpy(out, (const void*)raw_packet, sizeof(out));
-  SREG = sreg;
-
-  Wire.write(out, sizeof(out));
+  // Otherwise: legacy behavior — raw 12-byte packet on a bare read
+  sendInputFrame();
 }
 
 void setup() {
@@ -226,15 +277,23 @@ void setup() {
   Wire.onReceive(onI2CReceive);
   Wire.onRequest(onI2CRequest);
 
+  set_data_ready(false);
   refresh_cache();
+  refresh_battery();
 }
 
 void loop() {
-  static uint32_t last = 0;
+  // Inputs are sampled every 2 ms so a change reaches the data-ready line quickly; the
+  // battery EMA keeps its ~20 Hz step.
+  static uint32_t last_in = 0, last_bat = 0;
   uint32_t now = millis();
-  if (now - last >= 50) {  // ~20Hz refresh
-    last = now;
+  if (now - last_in >= 2) {
+    last_in = now;
     refresh_cache();
   }
+  if (now - last_bat >= 50) {
+    last_bat = now;
+    refresh_battery();
+  }
 }
 
@@ -221,11 +221,13 @@ do_update() {
 
 case "${1:-update}" in
   update) do_update ;;
+  setup) [[ ${EUID:-$(id -u)} -eq 0 ]] || die "run as root"; ensure_virtual_battery ;;
   status) status_virtual_battery ;;
   stop)  [[ ${EUID:-$(id -u)} -eq 0 ]] || die "run as root"; stop_virtual_battery ;;
   *)
     echo "Usage:"
     echo "  $0 update   # read I2C and write /sys/class/power_supply/BAT0/*"
+    echo "  $0 setup    # only build the fake tree (gpio_to_uinput --battery bat0 fills it)"
     echo "  $0 status"
     echo "  $0 stop"
     exit 2
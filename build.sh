@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ -O2 -std=c++17 gpio_to_uinput.cpp -o gpio_to_uinput
+g++ -O2 -std=c++17 -pthread gpio_to_uinput.cpp -o gpio_to_uinput
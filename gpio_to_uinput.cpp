@@ -2,11 +2,53 @@
 //
 // GPIO (Linux chardev v2) -> uinput virtual GAMEPAD + (optional) KEYBOARD.
 //
-// - Requests GPIO lines as INPUT + PULL-UP + BOTH EDGES.
+// - Requests GPIO lines as INPUT + PULL-UP + BOTH EDGES by default, packed into multi-line
+//   requests (up to 64 lines share one fd / kernel event FIFO; --per-line-requests restores
+//   one fd per line). Per-line bias, polarity, edges and kernel debounce from the map become
+//   attribute masks of the shared request.
 // - Treats FALLING as "press" and RISING as "release" by default (active-low buttons with pull-ups).
 // - Debouncing:
 //     (a) sets kernel debounce attr if supported
-//     (b) ALWAYS applies userspace time-based debounce using event timestamp_ns
+//     (b) ALWAYS applies userspace time-based debounce using event timestamp_ns: by default
+//         changes are reported at once and bounces are settled by re-reading the level when
+//         a per-line deadline expires (all deadlines share one hierarchical timer wheel and
+//         one timerfd); lockout/integrator/none can be picked globally
+//         (--debounce) or per line in the map (debounce=, debounce-us=)
+// - Reads every line's level at startup and again after a kernel FIFO overflow (seqno gap),
+//   reporting only lines that disagree with the last report.
+// - Lines whose chip refuses edge detection are requested as plain inputs and sampled with
+//   one GET_VALUES per request per tick; changed bits (XOR mask) go through the same
+//   debounce/dispatch path. The rate is --gpio-poll-us after activity, --gpio-poll-idle-us idle.
+// - Waits on all fds with epoll (each fd carries a pointer to its context); --loop poll keeps
+//   the original poll() scan for comparison.
+// - Optionally stamps input_events with the kernel edge timestamp (--event-time kernel),
+//   translated into the clock domain selected by --uinput-clock.
+// - Event logging is asynchronous: the input path pushes binary records into a lock-free
+//   ring and a low-priority thread writes text (default) or binary (--log binary) output.
+// - --latency-stats keeps per-source log-linear latency histograms; SIGUSR1 dumps them.
+// - --record FILE captures raw GPIO events + I2C frames; --replay FILE feeds them back
+//   through the same pipeline without hardware.
+// - GPIO input comes from a GpioBackend (chardev, kernel gpio-sim, or in-process fake) and
+//   reports go to an OutputSink (uinput, null, or fake pipes); --bench N times toggles of
+//   a simulated line end to end.
+// - Mapped lines held by another consumer are watched (LINEINFO_WATCH) and claimed from
+//   the loop once released, without restarting or re-creating the uinput devices.
+// - Chips and the I2C bus may come and go: /dev is watched with inotify, and nodes are
+//   attached when they appear and detached (held buttons released) when they disappear.
+// - --chip may repeat: map targets "chipN:offset" pick the chip, and every chip's lines
+//   share one event loop, one dispatch table and one set of uinput devices.
+// - "encoder A B ..." map lines decode a quadrature encoder from two lines with a state
+//   table and report detents as EV_REL on a third device or as key taps, one frame per read.
+// - The I2C bus is read by a sampler thread that hands frames to the input loop through a
+//   lock-free mailbox + eventfd, so bus stalls never delay GPIO edges (--cpu/--i2c-cpu pin).
+// - Each I2C poll is one I2C_RDWR transaction: register 0x80 (input frame) plus any
+//   --i2c-words SMBus registers, each as a register write + repeated-start read.
+// - --battery reads the SBS voltage/SOC words along with a poll, applies the Li-ion curve and
+//   an EMA, and publishes to a fake power_supply/BAT0 tree or the test_power parameters.
+// - The I2C poll runs at --i2c-interval-ms while inputs change and backs off exponentially to
+//   --i2c-idle-ms after --i2c-hold-ms of quiet.
+// - --i2c-irq names a GPIO the Arduino pulls low when its frame changed; the sampler reads
+//   on that edge and falls back to a slow watchdog poll (--i2c-watchdog-ms).
 // - Excludes offset 36 (RP1_PCIE_CLKREQ_N) because it can be very spammy.
 //
 // Mapping file format (ASCII):
@@ -19,6 +61,8 @@
 //   17 KEY_ENTER
 //   22 KEY_A
 //   23 BTN_START
+//   chip1:3 BTN_EAST     (line 3 of the second --chip)
+//   encoder 5 6 REL_WHEEL accel=4
 //   ...
 //
 // Supported token types in the mapping:
@@ -28,8 +72,13 @@
 //   - Aliases: A..Z, 0..9, ENTER, ESC, SPACE, TAB, BACKSPACE, UP/DOWN/LEFT/RIGHT, etc (see --list-options)
 //   - Numeric code: "28" -> raw EV_KEY code (sent to keyboard device)
 //
+// GPIO lines take optional key=value settings after the token:
+//   21 BTN_SOUTH debounce=integrator debounce-us=20000
+//   16 KEY_F12 edges=press bias=pull-down active-high kernel-debounce-us=0
+//
 // Build:
-//   g++ -O2 -std=c++17 gpio_to_uinput.cpp -o gpio_to_uinput
+//   g++ -O2 -std=c++17 -pthread gpio_to_uinput.cpp -o gpio_to_uinput
+//   (add -DGPIO_TO_UINPUT_ALLOC_CHECK to abort if the event path ever allocates)
 //
 // Run (Android usually needs root):
 //   su -c /data/local/tmp/gpio_to_uinput --chip /dev/gpiochip0 --start 2 --end 27 --map /data/local/tmp/gpio.map --debounce-us 10000
@@ -39,43 +88,100 @@
 //   Android: getevent -lp
 
 #include <linux/gpio.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <linux/uinput.h>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <climits>
+#include <cmath>
 #include <cctype>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#ifdef GPIO_TO_UINPUT_ALLOC_CHECK
+// Test hook (build with -DGPIO_TO_UINPUT_ALLOC_CHECK): count every heap allocation so
+// the main loop can abort if the steady-state event path ever allocates. The count is
+// per thread: the writer, sampler and bench threads allocate as they like.
+// The operators stay out of line so the compiler pairs new/delete, not new/free.
+#include <cstdlib>
+#include <new>
+static thread_local unsigned long g_alloc_count = 0;
+__attribute__((noinline)) void* operator new(size_t n) {
+  g_alloc_count++;
+  if (void* p = std::malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+__attribute__((noinline)) void* operator new[](size_t n) { return operator new(n); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept { std::free(p); }
+#endif
+
 static void die(const std::string& msg) {
   std::cerr << "ERROR: " << msg << " (errno=" << errno << " " << std::strerror(errno) << ")\n";
   std::exit(1);
 }
 
-static uint64_t monotonic_ns() {
+static uint64_t clock_ns(clockid_t clk) {
   timespec ts{};
-  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) die("clock_gettime");
+  if (clock_gettime(clk, &ts) != 0) die("clock_gettime");
   return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
 }
 
+static uint64_t monotonic_ns() {
+  return clock_ns(CLOCK_MONOTONIC);
+}
+
+// Re-expresses a timestamp taken on clock `from` in the domain of clock `to` using the
+// current offset between the two clocks.
+static uint64_t clock_translate_ns(uint64_t ts, clockid_t from, clockid_t to) {
+  if (from == to) return ts;
+  int64_t offset = (int64_t)clock_ns(to) - (int64_t)clock_ns(from);
+  return (uint64_t)((int64_t)ts + offset);
+}
+
+// Parses the clock names accepted by EVIOCSCLOCKID (realtime|monotonic|boottime).
+static std::optional<clockid_t> parse_clock_name(const std::string& s) {
+  if (s == "REALTIME") return CLOCK_REALTIME;
+  if (s == "MONOTONIC") return CLOCK_MONOTONIC;
+  if (s == "BOOTTIME") return CLOCK_BOOTTIME;
+  return std::nullopt;
+}
+
 static int xopen(const std::string& path, int flags) {
   int fd = ::open(path.c_str(), flags);
   if (fd < 0) die("open(" + path + ")");
@@ -110,6 +216,14 @@ static bool is_all_digits(const std::string& s) {
   return true;
 }
 
+// Decimal digits -> value, or nullopt when malformed or above `max` (never throws).
+static std::optional<uint32_t> parse_u32(const std::string& s, uint32_t max) {
+  if (!is_all_digits(s) || s.size() > 10) return std::nullopt;
+  const uint64_t v = std::stoull(s);
+  if (v > max) return std::nullopt;
+  return (uint32_t)v;
+}
+
 static uint16_t get_u16_le(const uint8_t* p) {
   return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
 }
@@ -122,29 +236,84 @@ static std::optional<gpio_v2_line_info> get_line_info(int chip_fd, uint32_t offs
   return info;
 }
 
-static std::optional<int> request_line(int chip_fd, uint32_t offset,
-                                       uint32_t event_buf_sz,
-                                       uint32_t debounce_us) {
+// Kernel-side configuration of one requested line.
+struct LineKernelConfig {
+  uint64_t flags = 0;        // GPIO_V2_LINE_FLAG_*: direction, bias, edges, event clock
+  uint32_t debounce_us = 0;  // kernel debounce period, 0 = none
+};
+
+static bool same_flags(const LineKernelConfig& a, const LineKernelConfig& b) { return a.flags == b.flags; }
+static bool same_debounce(const LineKernelConfig& a, const LineKernelConfig& b) {
+  return a.debounce_us == b.debounce_us;
+}
+
+// Number of gpio_v2_line_config attributes request_lines() needs for these lines: one
+// FLAGS attr per flag set other than the most common one (which goes in config.flags)
+// and one DEBOUNCE attr per distinct non-zero period.
+static size_t line_attrs_needed(const std::vector<LineKernelConfig>& cfgs) {
+  size_t flag_sets = 0, debounces = 0;
+  for (size_t i = 0; i < cfgs.size(); i++) {
+    bool first_flags = true, first_debounce = cfgs[i].debounce_us != 0;
+    for (size_t j = 0; j < i; j++) {
+      if (same_flags(cfgs[i], cfgs[j])) first_flags = false;
+      if (same_debounce(cfgs[i], cfgs[j])) first_debounce = false;
+    }
+    flag_sets += first_flags;
+    debounces += first_debounce;
+  }
+  return (flag_sets ? flag_sets - 1 : 0) + debounces;
+}
+
+// Requests up to GPIO_V2_LINES_MAX offsets through a single line request so all of
+// their edges share one fd and one kernel event FIFO. Events are demultiplexed
+// by gpio_v2_line_event.offset on read. Per-line settings become attribute masks, so
+// the lines must need at most GPIO_V2_LINE_NUM_ATTRS_MAX attributes.
+static std::optional<int> request_lines(int chip_fd, const std::vector<uint32_t>& offsets,
+                                        const std::vector<LineKernelConfig>& cfgs,
+                                        uint32_t event_buf_sz) {
+  if (offsets.empty() || offsets.size() > GPIO_V2_LINES_MAX || cfgs.size() != offsets.size()) return std::nullopt;
+  if (line_attrs_needed(cfgs) > GPIO_V2_LINE_NUM_ATTRS_MAX) return std::nullopt;
+
   gpio_v2_line_request req;
   std::memset(&req, 0, sizeof(req));
-  req.offsets[0] = offset;
-  req.num_lines = 1;
-  req.event_buffer_size = event_buf_sz;
+  for (size_t i = 0; i < offsets.size(); i++) req.offsets[i] = offsets[i];
+  req.num_lines = (uint32_t)offsets.size();
+  req.event_buffer_size = std::min<uint32_t>(event_buf_sz, GPIO_V2_LINES_MAX * 16);
   std::snprintf(req.consumer, sizeof(req.consumer), "gpio_to_uinput");
 
-  // INPUT + PULL-UP + BOTH EDGES
-  req.config.flags =
-      GPIO_V2_LINE_FLAG_INPUT |
-      GPIO_V2_LINE_FLAG_BIAS_PULL_UP |
-      GPIO_V2_LINE_FLAG_EDGE_RISING |
-      GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  // The most common flag set is the request default; the others are FLAGS attributes.
+  size_t best = 0, best_count = 0;
+  for (size_t i = 0; i < cfgs.size(); i++) {
+    size_t n = 0;
+    for (const auto& c : cfgs) n += same_flags(c, cfgs[i]);
+    if (n > best_count) { best = i; best_count = n; }
+  }
+  req.config.flags = cfgs[best].flags;
 
-  // Kernel debounce (if supported by kernel/driver).
-  if (debounce_us > 0) {
-    req.config.num_attrs = 1;
-    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
-    req.config.attrs[0].attr.debounce_period_us = debounce_us;
-    req.config.attrs[0].mask = 1ULL;
+  auto add_attr = [&](size_t first, bool flags_attr) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < cfgs.size(); i++) {
+      if (flags_attr ? same_flags(cfgs[i], cfgs[first]) : same_debounce(cfgs[i], cfgs[first])) mask |= 1ULL << i;
+    }
+    gpio_v2_line_config_attribute& a = req.config.attrs[req.config.num_attrs++];
+    a.mask = mask;
+    if (flags_attr) {
+      a.attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+      a.attr.flags = cfgs[first].flags;
+    } else {
+      // Kernel debounce (if supported by kernel/driver).
+      a.attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+      a.attr.debounce_period_us = cfgs[first].debounce_us;
+    }
+  };
+  for (size_t i = 0; i < cfgs.size(); i++) {
+    bool first_flags = !same_flags(cfgs[i], cfgs[best]), first_debounce = cfgs[i].debounce_us != 0;
+    for (size_t j = 0; j < i; j++) {
+      if (same_flags(cfgs[i], cfgs[j])) first_flags = false;
+      if (same_debounce(cfgs[i], cfgs[j])) first_debounce = false;
+    }
+    if (first_flags) add_attr(i, true);
+    if (first_debounce) add_attr(i, false);
   }
 
   if (::ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) return std::nullopt;
@@ -154,43 +323,401 @@ static std::optional<int> request_line(int chip_fd, uint32_t offset,
   return req.fd;
 }
 
-// --- uinput helpers ---
+// --- GPIO backends ---
+//
+// Everything the daemon needs from a gpiochip goes through GpioBackend: the real
+// chardev, a kernel gpio-sim chip created through configfs, or an in-process fake.
+// Line requests always come back as a non-blocking fd that yields gpio_v2_line_event
+// records on read(), so the event path is identical for every backend. Simulated
+// backends can additionally drive input levels for tests and benchmarks.
+
+// Attribute files (sysfs, configfs) already exist; `create` makes and truncates a plain
+// file instead. On failure errno describes the open or the write.
+static bool write_text_file(const std::string& path, const char* text, bool create = false) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+  if (fd < 0) return false;
+  const size_t len = std::strlen(text);
+  const ssize_t n = ::write(fd, text, len);
+  const int err = n < 0 ? errno : EIO;  // a short write leaves errno alone
+  ::close(fd);
+  if (n == (ssize_t)len) return true;
+  errno = err;
+  return false;
+}
 
-static void uinput_emit(int ufd, uint16_t type, uint16_t code, int32_t value) {
-  input_event ev;
-  std::memset(&ev, 0, sizeof(ev));
-  timeval tv{};
-  gettimeofday(&tv, nullptr);
-  ev.time = tv;
-  ev.type = type;
-  ev.code = code;
-  ev.value = value;
-  if (::write(ufd, &ev, sizeof(ev)) != (ssize_t)sizeof(ev)) die("write(uinput event)");
+static std::string read_text_file(const std::string& path) {
+  std::ifstream in(path);
+  std::string s;
+  std::getline(in, s);
+  return trim(s);
+}
+
+enum class BackendKind { Chardev, GpioSim, Fake };
+
+class GpioBackend {
+ public:
+  virtual ~GpioBackend() = default;
+  virtual std::string describe() const = 0;
+  virtual uint32_t num_lines() const = 0;
+  virtual std::optional<gpio_v2_line_info> line_info(uint32_t offset) = 0;
+  virtual std::optional<int> request_lines(const std::vector<uint32_t>& offsets,
+                                           const std::vector<LineKernelConfig>& cfgs,
+                                           uint32_t event_buf_sz) = 0;
+  // Reads the current levels of a request's lines (GPIO_V2_LINE_GET_VALUES_IOCTL).
+  virtual bool get_values(int req_fd, gpio_v2_line_values& vals) = 0;
+  // Drives the physical level of an input from outside (simulated backends only).
+  virtual bool set_input_level(uint32_t /*offset*/, bool /*high*/) { return false; }
+  // Line-info watches (GPIO_V2_GET_LINEINFO_WATCH_IOCTL): changes to watched lines arrive
+  // as gpio_v2_line_info_changed records on info_fd(), which is -1 if unsupported.
+  virtual int info_fd() const { return -1; }
+  virtual bool watch_line(uint32_t /*offset*/) { return false; }
+  virtual void unwatch_line(uint32_t /*offset*/) {}
+};
+
+class ChardevBackend : public GpioBackend {
+ public:
+  explicit ChardevBackend(const std::string& path) { open_chip(path); }
+  ~ChardevBackend() override {
+    if (chip_fd_ >= 0) ::close(chip_fd_);
+  }
+  // Like the constructor, but returns nullptr instead of dying when the chip cannot be
+  // opened yet (node not created, or udev has not fixed its permissions).
+  static std::unique_ptr<ChardevBackend> try_open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    gpiochip_info cinfo;
+    std::memset(&cinfo, 0, sizeof(cinfo));
+    if (::ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &cinfo) < 0) {
+      ::close(fd);
+      return nullptr;
+    }
+    std::unique_ptr<ChardevBackend> b(new ChardevBackend());
+    b->path_ = path;
+    b->chip_fd_ = fd;
+    b->lines_ = cinfo.lines;
+    return b;
+  }
+
+  std::string describe() const override { return path_; }
+  uint32_t num_lines() const override { return lines_; }
+  std::optional<gpio_v2_line_info> line_info(uint32_t offset) override {
+    return get_line_info(chip_fd_, offset);
+  }
+  std::optional<int> request_lines(const std::vector<uint32_t>& offsets,
+                                   const std::vector<LineKernelConfig>& cfgs,
+                                   uint32_t event_buf_sz) override {
+    return ::request_lines(chip_fd_, offsets, cfgs, event_buf_sz);
+  }
+  bool get_values(int req_fd, gpio_v2_line_values& vals) override {
+    return ::ioctl(req_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &vals) == 0;
+  }
+  int info_fd() const override { return chip_fd_; }
+  bool watch_line(uint32_t offset) override {
+    gpio_v2_line_info info;
+    std::memset(&info, 0, sizeof(info));
+    info.offset = offset;
+    return ::ioctl(chip_fd_, GPIO_V2_GET_LINEINFO_WATCH_IOCTL, &info) == 0;
+  }
+  void unwatch_line(uint32_t offset) override {
+    ::ioctl(chip_fd_, GPIO_GET_LINEINFO_UNWATCH_IOCTL, &offset);
+  }
+
+ protected:
+  ChardevBackend() = default;
+  void open_chip(const std::string& path) {
+    path_ = path;
+    chip_fd_ = xopen(path, O_RDONLY | O_CLOEXEC);
+    gpiochip_info cinfo;
+    std::memset(&cinfo, 0, sizeof(cinfo));
+    if (::ioctl(chip_fd_, GPIO_GET_CHIPINFO_IOCTL, &cinfo) < 0) die("GPIO_GET_CHIPINFO_IOCTL");
+    lines_ = cinfo.lines;
+  }
+
+  std::string path_;
+  int chip_fd_ = -1;
+  uint32_t lines_ = 0;
+};
+
+// A kernel gpio-sim chip (CONFIG_GPIO_SIM) created through configfs. The daemon talks
+// to it through the regular chardev, and inputs are driven by writing the simulated
+// pull of each line in sysfs, so the whole kernel edge path is exercised.
+class GpioSimBackend : public ChardevBackend {
+ public:
+  explicit GpioSimBackend(uint32_t num_lines) {
+    static const char* kConfigfs = "/sys/kernel/config/gpio-sim";
+    static int instances = 0;  // one configfs device per simulated --chip
+    dir_ = std::string(kConfigfs) + "/gpio_to_uinput-" + std::to_string(::getpid()) + "-" +
+           std::to_string(instances++);
+    if (::mkdir(dir_.c_str(), 0755) < 0) die("mkdir(" + dir_ + ") (is gpio-sim loaded and configfs mounted?)");
+    if (::mkdir((dir_ + "/bank0").c_str(), 0755) < 0) die("mkdir(" + dir_ + "/bank0)");
+    if (!write_text_file(dir_ + "/bank0/num_lines", std::to_string(num_lines).c_str())) die("gpio-sim num_lines");
+    if (!write_text_file(dir_ + "/live", "1")) die("gpio-sim live");
+
+    std::string chip = read_text_file(dir_ + "/bank0/chip_name");
+    sysfs_ = "/sys/devices/platform/" + read_text_file(dir_ + "/dev_name") + "/" + chip;
+    open_chip("/dev/" + chip);
+  }
+  ~GpioSimBackend() override {
+    if (chip_fd_ >= 0) ::close(chip_fd_);
+    chip_fd_ = -1;
+    write_text_file(dir_ + "/live", "0");
+    ::rmdir((dir_ + "/bank0").c_str());
+    ::rmdir(dir_.c_str());
+  }
+
+  std::string describe() const override { return path_ + " (gpio-sim)"; }
+  bool set_input_level(uint32_t offset, bool high) override {
+    return write_text_file(sysfs_ + "/sim_gpio" + std::to_string(offset) + "/pull",
+                           high ? "pull-up" : "pull-down");
+  }
+
+ private:
+  std::string dir_;
+  std::string sysfs_;
+};
+
+// In-process fake chip: each line request is a pipe, and set_input_level() writes the
+// resulting gpio_v2_line_event into it, so no kernel GPIO support is needed at all.
+class FakeBackend : public GpioBackend {
+ public:
+  explicit FakeBackend(uint32_t num_lines) : levels_(num_lines) {
+    for (auto& l : levels_) l.store(true);  // idle high, like a pulled-up button
+    line_req_.assign(num_lines, -1);
+    line_edges_.assign(num_lines, 0);
+    line_seqno_.assign(num_lines, 0);
+  }
+  ~FakeBackend() override {
+    for (const auto& r : reqs_) ::close(r.write_fd);
+  }
+
+  std::string describe() const override { return "fake"; }
+  uint32_t num_lines() const override { return (uint32_t)levels_.size(); }
+  std::optional<gpio_v2_line_info> line_info(uint32_t offset) override {
+    if (offset >= levels_.size()) return std::nullopt;
+    gpio_v2_line_info info;
+    std::memset(&info, 0, sizeof(info));
+    info.offset = offset;
+    std::snprintf(info.name, sizeof(info.name), "FAKE%u", (unsigned)offset);
+    info.flags = GPIO_V2_LINE_FLAG_INPUT | (line_req_[offset] >= 0 ? GPIO_V2_LINE_FLAG_USED : 0);
+    return info;
+  }
+  std::optional<int> request_lines(const std::vector<uint32_t>& offsets,
+                                   const std::vector<LineKernelConfig>& cfgs,
+                                   uint32_t /*event_buf_sz*/) override {
+    if (offsets.empty() || cfgs.size() != offsets.size()) return std::nullopt;
+    for (uint32_t off : offsets) {
+      if (off >= levels_.size() || line_req_[off] >= 0) return std::nullopt;
+    }
+    int p[2];
+    if (::pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0) return std::nullopt;
+    for (size_t i = 0; i < offsets.size(); i++) {
+      const uint32_t off = offsets[i];
+      line_req_[off] = (int)reqs_.size();
+      line_edges_[off] = cfgs[i].flags & (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING);
+      levels_[off].store((cfgs[i].flags & GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN) == 0);
+    }
+    reqs_.push_back(Req{p[0], p[1], (cfgs[0].flags & GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME) ? CLOCK_REALTIME
+                                                                                               : CLOCK_MONOTONIC,
+                        0, offsets});
+    return p[0];
+  }
+  bool get_values(int req_fd, gpio_v2_line_values& vals) override {
+    for (const auto& r : reqs_) {
+      if (r.read_fd != req_fd) continue;
+      uint64_t bits = 0;
+      for (size_t i = 0; i < r.offsets.size(); i++) bits |= (uint64_t)levels_[r.offsets[i]].load() << i;
+      vals.bits = bits & vals.mask;
+      return true;
+    }
+    return false;
+  }
+  bool set_input_level(uint32_t offset, bool high) override {
+    if (offset >= levels_.size()) return false;
+    if (levels_[offset].exchange(high) == high) return true;
+    int ri = line_req_[offset];
+    if (ri < 0) return true;
+    if (!(line_edges_[offset] & (high ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING))) {
+      return true;  // edge not requested on this line
+    }
+    Req& r = reqs_[(size_t)ri];
+    gpio_v2_line_event e;
+    std::memset(&e, 0, sizeof(e));
+    e.timestamp_ns = clock_ns(r.clock);
+    e.id = high ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    e.offset = offset;
+    e.seqno = ++r.seqno;
+    e.line_seqno = ++line_seqno_[offset];
+    return ::write(r.write_fd, &e, sizeof(e)) == (ssize_t)sizeof(e);
+  }
+
+ private:
+  struct Req {
+    int read_fd;
+    int write_fd;
+    clockid_t clock;
+    uint32_t seqno = 0;
+    std::vector<uint32_t> offsets;
+  };
+  std::vector<std::atomic<bool>> levels_;  // physical level; driven from the test thread
+  std::vector<int> line_req_;              // offset -> index into reqs_, -1 if not requested
+  std::vector<uint64_t> line_edges_;       // requested EDGE_* flags per offset
+  std::vector<uint32_t> line_seqno_;       // gpio_v2_line_event.line_seqno per offset
+  std::vector<Req> reqs_;
+};
+
+// --- event loop ---
+//
+// Every fd the main loop waits on is described by an EventSource whose address is
+// handed to the backend (epoll_event.data.ptr), so a wakeup yields the context to
+// dispatch directly instead of a scan over all watched fds. The poll() backend is
+// kept for comparison (--loop poll) and walks its pollfd array as before.
+
+enum class LoopBackend { Epoll, Poll };
+enum class SourceKind { GpioRequest, LineInfo, Hotplug, Signal, Timer, I2cFrames };
+
+struct EventSource {
+  SourceKind kind;
+  int fd;
+  void* ctx;  // owner of the fd (e.g. LineRequest*), interpreted according to kind
+};
+
+struct EventLoop {
+  LoopBackend backend = LoopBackend::Epoll;
+  int epfd = -1;
+  std::vector<epoll_event> epoll_ready;
+  std::vector<pollfd> pfds;            // poll backend only
+  std::vector<EventSource*> sources;   // poll backend only, parallel to pfds
+};
+
+static void event_loop_init(EventLoop& loop, LoopBackend backend) {
+  loop.backend = backend;
+  if (backend == LoopBackend::Epoll) {
+    loop.epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epfd < 0) die("epoll_create1");
+    loop.epoll_ready.resize(32);
+  }
+}
+
+static void event_loop_add(EventLoop& loop, EventSource* src) {
+  if (loop.backend == LoopBackend::Epoll) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = src;
+    if (::epoll_ctl(loop.epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) die("epoll_ctl(ADD)");
+    return;
+  }
+  pollfd p{};
+  p.fd = src->fd;
+  p.events = POLLIN;
+  loop.pfds.push_back(p);
+  loop.sources.push_back(src);
+}
+
+static void event_loop_del(EventLoop& loop, EventSource* src) {
+  if (loop.backend == LoopBackend::Epoll) {
+    ::epoll_ctl(loop.epfd, EPOLL_CTL_DEL, src->fd, nullptr);
+    return;
+  }
+  for (size_t i = 0; i < loop.sources.size(); i++) {
+    if (loop.sources[i] != src) continue;
+    loop.pfds.erase(loop.pfds.begin() + (long)i);
+    loop.sources.erase(loop.sources.begin() + (long)i);
+    return;
+  }
 }
 
-static void uinput_syn(int ufd) {
-  uinput_emit(ufd, EV_SYN, SYN_REPORT, 0);
+// Waits up to timeout_ms (-1 = forever) and fills `ready` with the sources that have
+// input pending. Returns false if interrupted by a signal.
+static bool event_loop_wait(EventLoop& loop, int timeout_ms, std::vector<EventSource*>& ready) {
+  ready.clear();
+  if (loop.backend == LoopBackend::Epoll) {
+    int n = ::epoll_wait(loop.epfd, loop.epoll_ready.data(), (int)loop.epoll_ready.size(), timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR) return false;
+      die("epoll_wait()");
+    }
+    for (int i = 0; i < n; i++) ready.push_back(static_cast<EventSource*>(loop.epoll_ready[i].data.ptr));
+    return true;
+  }
+
+  int r = ::poll(loop.pfds.data(), loop.pfds.size(), timeout_ms);
+  if (r < 0) {
+    if (errno == EINTR) return false;
+    die("poll()");
+  }
+  if (r == 0) return true;
+  for (size_t i = 0; i < loop.pfds.size(); i++) {
+    if (loop.pfds[i].revents & (POLLIN | POLLERR | POLLHUP)) ready.push_back(loop.sources[i]);
+  }
+  return true;
 }
 
-static void uinput_key(int ufd, int code, bool down) {
-  uinput_emit(ufd, EV_KEY, (uint16_t)code, down ? 1 : 0);
-  uinput_syn(ufd);
+// --- uinput helpers ---
+
+// Events for one uinput device are staged into a frame and written with a single
+// write() that ends in one SYN_REPORT, so a batch of edges (or one I2C poll) costs
+// one syscall per device and reaches consumers as one atomic report.
+static constexpr size_t kUinputFrameMax = 64;
+
+struct UinputFrame {
+  int fd = -1;
+  clockid_t clock = CLOCK_REALTIME;  // domain of input_event.time written to this device
+  uint64_t event_ns = 0;             // source time of the frame (in `clock`), 0 = stamp at flush
+  size_t count = 0;
+  input_event events[kUinputFrameMax];
+};
+
+static void uinput_flush(UinputFrame& f) {
+  if (f.count == 0 || f.fd < 0) {
+    f.count = 0;
+    f.event_ns = 0;
+    return;
+  }
+  input_event& syn = f.events[f.count++];
+  std::memset(&syn, 0, sizeof(syn));
+  syn.type = EV_SYN;
+  syn.code = SYN_REPORT;
+
+  uint64_t ns = f.event_ns ? f.event_ns : clock_ns(f.clock);
+  f.event_ns = 0;
+  timeval tv{};
+  tv.tv_sec = (time_t)(ns / 1000000000ULL);
+  tv.tv_usec = (suseconds_t)((ns % 1000000000ULL) / 1000ULL);
+  for (size_t i = 0; i < f.count; i++) f.events[i].time = tv;
+
+  ssize_t want = (ssize_t)(f.count * sizeof(input_event));
+  f.count = 0;
+  if (::write(f.fd, f.events, (size_t)want) != want) die("write(uinput frame)");
 }
 
-static void uinput_abs(int ufd, uint16_t code, int32_t value) {
-  uinput_emit(ufd, EV_ABS, code, value);
+static void uinput_stage(UinputFrame& f, uint16_t type, uint16_t code, int32_t value) {
+  if (f.fd < 0) return;
+  // A second change of the same code would be collapsed by the consumer (e.g. a tap
+  // read as DOWN+UP in one batch), so close the current frame first.
+  bool dup = false;
+  for (size_t i = 0; i < f.count; i++) {
+    if (f.events[i].type == type && f.events[i].code == code) { dup = true; break; }
+  }
+  if (dup || f.count + 1 >= kUinputFrameMax) uinput_flush(f);
+
+  input_event& ev = f.events[f.count++];
+  std::memset(&ev, 0, sizeof(ev));
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
 }
 
 // --- Mapping / Actions ---
 
-enum class DeviceKind { Gamepad, Keyboard };
-enum class ActionType { ButtonOrKey, HatDir };
+enum class DeviceKind { Gamepad, Keyboard, Relative };
+enum class ActionType { ButtonOrKey, HatDir, Encoder, I2cIrq };
 enum class HatDir { Up, Down, Left, Right };
 
 struct Action {
   ActionType type;
-  DeviceKind dev;     // for ButtonOrKey: which uinput device to send to
-  int code;           // EV_KEY code for ButtonOrKey
+  DeviceKind dev;     // for ButtonOrKey / Encoder: which uinput device to send to
+  int code;           // EV_KEY code for ButtonOrKey; Encoder: index into MappingResult::encoders
+                      // (I2cIrq: the co-processor's data-ready line, --i2c-irq)
   HatDir hat_dir;     // for HatDir
   std::string token;  // original token for logging
 };
@@ -199,12 +726,90 @@ enum class MapEntryKind { Gpio, I2cDigital };
 
 struct MapEntryKey {
   MapEntryKind kind;
-  uint32_t id;
+  uint32_t id;  // Gpio: line_key(), I2cDigital: Arduino pin
+};
+
+// Userspace debounce applied to a GPIO line (map option debounce=, default --debounce).
+//   Settle:     report a change at once; bounces inside the window are confirmed by
+//               re-reading the level once the line has been quiet for the window.
+//   Lockout:    report an edge at once and drop every edge inside the window after it.
+//   Integrator: sample the level kIntegratorSteps times per window while it moves and
+//               report once the counter saturates (adds one window of latency, rejects
+//               short glitches entirely).
+//   None:       report every edge.
+enum class DebounceStrategy : uint8_t { Settle, Lockout, Integrator, None };
+
+static constexpr uint8_t kIntegratorSteps = 4;
+
+static std::optional<DebounceStrategy> parse_debounce_strategy(const std::string& name) {
+  std::string v = upper(trim(name));
+  if (v == "SETTLE") return DebounceStrategy::Settle;
+  if (v == "LOCKOUT" || v == "EAGER") return DebounceStrategy::Lockout;
+  if (v == "INTEGRATOR") return DebounceStrategy::Integrator;
+  if (v == "NONE" || v == "PASSTHROUGH") return DebounceStrategy::None;
+  return std::nullopt;
+}
+
+static const char* debounce_strategy_name(DebounceStrategy d) {
+  switch (d) {
+    case DebounceStrategy::Settle: return "settle";
+    case DebounceStrategy::Lockout: return "lockout";
+    case DebounceStrategy::Integrator: return "integrator";
+    case DebounceStrategy::None: return "none";
+  }
+  return "?";
+}
+
+// Which edges of a line are requested. Press/Release lines only wake up on that edge
+// and report a tap (press + release) for each one.
+enum class LineEdges : uint8_t { Both, Press, Release };
+
+static uint64_t edge_flags_for(LineEdges edges, uint64_t press_edge, uint64_t release_edge) {
+  switch (edges) {
+    case LineEdges::Both: return press_edge | release_edge;
+    case LineEdges::Press: return press_edge;
+    case LineEdges::Release: return release_edge;
+  }
+  return press_edge | release_edge;
+}
+
+// Debounce windows are kept in ns in a uint32_t (LineSlot::window_ns), about 4.29 s at most.
+static constexpr uint32_t kMaxDebounceUs = UINT32_MAX / 1000U;
+
+// Per-line options given after the token in the map file; unset fields use the defaults.
+struct LineConfig {
+  std::optional<DebounceStrategy> debounce;
+  std::optional<uint32_t> debounce_us;
+  std::optional<uint64_t> bias;           // GPIO_V2_LINE_FLAG_BIAS_* or 0 (as-is)
+  std::optional<bool> active_low;
+  std::optional<LineEdges> edges;
+  std::optional<uint32_t> kernel_debounce_us;
+};
+
+// GPIO map keys name a line on one of the --chip options: (chip index << kChipKeyShift) |
+// offset, so lines on the first chip are keyed by their plain offset.
+static constexpr uint32_t kChipKeyShift = 16;
+static inline uint32_t line_key(uint32_t chip, uint32_t offset) { return (chip << kChipKeyShift) | offset; }
+static inline uint32_t key_chip(uint32_t key) { return key >> kChipKeyShift; }
+static inline uint32_t key_offset(uint32_t key) { return key & ((1u << kChipKeyShift) - 1); }
+
+// A quadrature encoder bound to two GPIO lines ("encoder A B OUTPUT ..." in the map).
+// Output is a relative axis (rel_code) or a pair of keys pulsed once per detent.
+struct EncoderSpec {
+  uint32_t key_a = 0, key_b = 0;  // line_key()s of the A and B channels
+  DeviceKind dev = DeviceKind::Relative;
+  int rel_code = -1;              // REL_* code, or -1 for key pulses
+  int key_ccw = 0, key_cw = 0;    // EV_KEY codes for key pulses
+  uint8_t steps = 4;              // quadrature transitions per detent (1, 2 or 4)
+  uint8_t accel = 1;              // max velocity multiplier (1 = no acceleration)
+  std::string token;              // output as written in the map, for logging
 };
 
 struct MappingResult {
-  std::unordered_map<uint32_t, Action> gpio;
+  std::unordered_map<uint32_t, Action> gpio;  // keyed by line_key()
+  std::unordered_map<uint32_t, LineConfig> gpio_cfg;
   std::unordered_map<uint32_t, Action> i2c_digital;
+  std::vector<EncoderSpec> encoders;
 };
 
 // Buttons we explicitly support by name (still can use numeric fallback).
@@ -397,12 +1002,30 @@ static std::optional<Action> action_from_token(std::string tok) {
   return Action{ActionType::ButtonOrKey, DeviceKind::Keyboard, *kc, HatDir::Up, tok};
 }
 
+// "17" or "chipN:17" -> line_key(). Map targets, encoder channels and --i2c-irq all
+// name GPIO lines through this, so they accept the same syntax.
+static std::optional<uint32_t> parse_gpio_key(std::string tok) {
+  tok = upper(trim(tok));
+  std::optional<uint32_t> chip = 0;
+  if (tok.rfind("CHIP", 0) == 0) {
+    const size_t colon = tok.find(':');
+    if (colon == std::string::npos) return std::nullopt;
+    chip = parse_u32(tok.substr(4, colon - 4), (1u << (32 - kChipKeyShift)) - 1);
+    tok = tok.substr(colon + 1);
+  }
+  const auto off = parse_u32(tok, (1u << kChipKeyShift) - 1);
+  if (!chip || !off) return std::nullopt;
+  return line_key(*chip, *off);
+}
+
 static std::optional<MapEntryKey> parse_map_target(std::string tok) {
   tok = upper(trim(tok));
   if (tok.empty()) return std::nullopt;
 
-  if (is_all_digits(tok)) {
-    return MapEntryKey{MapEntryKind::Gpio, (uint32_t)std::stoul(tok)};
+  if (is_all_digits(tok) || tok.rfind("CHIP", 0) == 0) {
+    const auto key = parse_gpio_key(tok);
+    if (!key) return std::nullopt;
+    return MapEntryKey{MapEntryKind::Gpio, *key};
   }
 
   auto parse_i2c_pin = [](const std::string& digits) -> std::optional<MapEntryKey> {
@@ -425,6 +1048,72 @@ static std::optional<MapEntryKey> parse_map_target(std::string tok) {
   return std::nullopt;
 }
 
+static std::optional<int> rel_code_from_string(const std::string& tok) {
+  if (tok == "REL_WHEEL") return REL_WHEEL;
+  if (tok == "REL_HWHEEL") return REL_HWHEEL;
+  if (tok == "REL_DIAL") return REL_DIAL;
+  if (tok == "REL_MISC") return REL_MISC;
+  return std::nullopt;
+}
+
+// "encoder A B REL_WHEEL|<ccw token> <cw token> [steps=N] [accel=N]"
+static void parse_encoder_line(MappingResult& m, std::istringstream& iss, int ln) {
+  std::string a_s, b_s, out;
+  if (!(iss >> a_s >> b_s >> out)) {
+    std::cerr << "WARN: bad encoder line " << ln << "\n";
+    return;
+  }
+  auto a = parse_gpio_key(a_s), b = parse_gpio_key(b_s);
+  if (!a || !b || *a == *b) {
+    std::cerr << "WARN: encoder on line " << ln << " needs two distinct GPIO lines\n";
+    return;
+  }
+  EncoderSpec enc;
+  enc.key_a = *a;
+  enc.key_b = *b;
+  enc.token = upper(out);
+  if (auto rel = rel_code_from_string(enc.token)) {
+    enc.rel_code = *rel;
+  } else {
+    std::string cw_s;
+    auto ccw = action_from_token(out);
+    auto cw = (iss >> cw_s) ? action_from_token(cw_s) : std::nullopt;
+    if (!ccw || !cw || ccw->type != ActionType::ButtonOrKey || cw->type != ActionType::ButtonOrKey ||
+        ccw->dev != cw->dev) {
+      std::cerr << "WARN: encoder on line " << ln
+                << " needs REL_WHEEL|REL_HWHEEL|REL_DIAL|REL_MISC or two keys/buttons of one device\n";
+      return;
+    }
+    enc.dev = ccw->dev;
+    enc.key_ccw = ccw->code;
+    enc.key_cw = cw->code;
+    enc.token = ccw->token + "/" + cw->token;
+  }
+  std::string opt;
+  while (iss >> opt) {
+    size_t eq = opt.find('=');
+    std::string key = upper(opt.substr(0, eq));
+    std::string val = eq == std::string::npos ? "" : opt.substr(eq + 1);
+    if (key == "STEPS" && (val == "1" || val == "2" || val == "4")) {
+      enc.steps = (uint8_t)std::stoul(val);
+    } else if (key == "ACCEL" && is_all_digits(val) && !val.empty() && val.size() <= 2 && std::stoul(val) >= 1) {
+      enc.accel = (uint8_t)std::stoul(val);
+    } else {
+      std::cerr << "WARN: ignoring option '" << opt << "' on line " << ln << "\n";
+    }
+  }
+  // Both channels share one Action that points back at the spec; encoders ignore
+  // debounce (the state table rejects bounce), so kernel debounce defaults to off too.
+  const Action act{ActionType::Encoder, enc.dev, (int)m.encoders.size(), HatDir::Up, "ENCODER:" + enc.token};
+  for (uint32_t key : {enc.key_a, enc.key_b}) {
+    m.gpio[key] = act;
+    LineConfig cfg;
+    cfg.kernel_debounce_us = 0;
+    m.gpio_cfg[key] = cfg;
+  }
+  m.encoders.push_back(enc);
+}
+
 static MappingResult load_mapping_file(const std::string& path) {
   MappingResult m;
   std::ifstream in(path);
@@ -437,7 +1126,17 @@ static MappingResult load_mapping_file(const std::string& path) {
     line = trim(line);
     if (line.empty() || line[0] == '#') continue;
 
-    for (char& c : line) if (c == ':') c = ' ';
+    if (upper(line.substr(0, 8)) == "ENCODER " || upper(line.substr(0, 8)) == "ENCODER\t") {
+      std::istringstream iss(line.substr(8));
+      parse_encoder_line(m, iss, ln);
+      continue;
+    }
+
+    // "chipN:offset" targets the N-th --chip (counting from 0); a bare offset means chip0.
+    // That colon belongs to the target; any later one separates fields.
+    size_t fields = 0;
+    if (upper(line.substr(0, 4)) == "CHIP" && line.find(':') != std::string::npos) fields = line.find(':') + 1;
+    for (size_t i = fields; i < line.size(); i++) if (line[i] == ':') line[i] = ' ';
     std::istringstream iss(line);
 
     std::string gpio_s, tok;
@@ -459,7 +1158,44 @@ static MappingResult load_mapping_file(const std::string& path) {
     }
 
     if (target->kind == MapEntryKind::Gpio) {
-      m.gpio[target->id] = *act;
+      const uint32_t key = target->id;
+      m.gpio[key] = *act;
+      LineConfig cfg;
+      std::string opt;
+      while (iss >> opt) {
+        size_t eq = opt.find('=');
+        std::string opt_key = upper(opt.substr(0, eq));
+        std::string val = eq == std::string::npos ? "" : opt.substr(eq + 1);
+        std::string v = upper(val);
+        if (opt_key == "DEBOUNCE" && parse_debounce_strategy(val)) {
+          cfg.debounce = parse_debounce_strategy(val);
+        } else if (opt_key == "DEBOUNCE-US" && parse_u32(val, kMaxDebounceUs)) {
+          cfg.debounce_us = parse_u32(val, kMaxDebounceUs);
+        } else if (opt_key == "KERNEL-DEBOUNCE-US" && parse_u32(val, UINT32_MAX)) {
+          cfg.kernel_debounce_us = parse_u32(val, UINT32_MAX);
+        } else if (opt_key == "BIAS" && v == "PULL-UP") {
+          cfg.bias = GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+        } else if (opt_key == "BIAS" && v == "PULL-DOWN") {
+          cfg.bias = GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+        } else if (opt_key == "BIAS" && v == "DISABLED") {
+          cfg.bias = GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+        } else if (opt_key == "BIAS" && v == "AS-IS") {
+          cfg.bias = 0;
+        } else if (opt_key == "ACTIVE-LOW" && eq == std::string::npos) {
+          cfg.active_low = true;
+        } else if (opt_key == "ACTIVE-HIGH" && eq == std::string::npos) {
+          cfg.active_low = false;
+        } else if (opt_key == "EDGES" && v == "BOTH") {
+          cfg.edges = LineEdges::Both;
+        } else if (opt_key == "EDGES" && v == "PRESS") {
+          cfg.edges = LineEdges::Press;
+        } else if (opt_key == "EDGES" && v == "RELEASE") {
+          cfg.edges = LineEdges::Release;
+        } else {
+          std::cerr << "WARN: ignoring option '" << opt << "' on line " << ln << "\n";
+        }
+      }
+      m.gpio_cfg[key] = cfg;
     } else {
       m.i2c_digital[target->id] = *act;
     }
@@ -559,19 +1295,17 @@ static int create_uinput_gamepad(const std::set<int>& button_codes,
 
   usleep(100 * 1000);
 
+  UinputFrame init;
+  init.fd = ufd;
   if (need_hat) {
-    uinput_abs(ufd, ABS_HAT0X, 0);
-    uinput_abs(ufd, ABS_HAT0Y, 0);
-    uinput_syn(ufd);
+    uinput_stage(init, EV_ABS, ABS_HAT0X, 0);
+    uinput_stage(init, EV_ABS, ABS_HAT0Y, 0);
   }
-
-  if (!analog_axes.empty()) {
-    for (const auto& axis : analog_axes) {
-      int center = std::max(axis.min, std::min(axis.max, (axis.min + axis.max) / 2));
-      uinput_abs(ufd, axis.code, center);
-    }
-    uinput_syn(ufd);
+  for (const auto& axis : analog_axes) {
+    int center = std::max(axis.min, std::min(axis.max, (axis.min + axis.max) / 2));
+    uinput_stage(init, EV_ABS, axis.code, center);
   }
+  uinput_flush(init);
 
   return ufd;
 }
@@ -603,6 +1337,125 @@ static int create_uinput_keyboard(const std::set<int>& key_codes) {
   return ufd;
 }
 
+static int create_uinput_relative(const std::set<int>& rel_codes) {
+  int ufd = xopen("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+  if (ioctl(ufd, UI_SET_EVBIT, EV_REL) < 0) die("UI_SET_EVBIT EV_REL");
+  if (ioctl(ufd, UI_SET_EVBIT, EV_SYN) < 0) die("UI_SET_EVBIT EV_SYN");
+  for (int rc : rel_codes) {
+    if (ioctl(ufd, UI_SET_RELBIT, rc) < 0) die("UI_SET_RELBIT");
+  }
+
+  uinput_setup usetup{};
+  std::snprintf(usetup.name, sizeof(usetup.name), "gpio-virtual-relative");
+  usetup.id.bustype = BUS_USB;
+  usetup.id.vendor  = 0x18D1;
+  usetup.id.product = 0x0003;
+  usetup.id.version = 1;
+
+  if (ioctl(ufd, UI_DEV_SETUP, &usetup) < 0) die("UI_DEV_SETUP (relative)");
+  if (ioctl(ufd, UI_DEV_CREATE) < 0) die("UI_DEV_CREATE (relative)");
+
+  usleep(100 * 1000);
+  return ufd;
+}
+
+// --- output sinks ---
+//
+// Where the input frames go. UinputSink creates the real virtual devices; NullSink
+// discards frames (replays and benchmarks without /dev/uinput); FakeSink hands each
+// device a pipe whose read end a test harness can consume. Every sink returns a plain
+// fd, so uinput_flush() is the single write path regardless of the sink.
+
+enum class SinkKind { Uinput, Null, Fake };
+
+class OutputSink {
+ public:
+  virtual ~OutputSink() = default;
+  virtual const char* describe() const = 0;
+  virtual int create_gamepad(const std::set<int>& buttons, bool need_hat,
+                             const std::vector<AbsAxisSetup>& axes) = 0;
+  virtual int create_keyboard(const std::set<int>& keys) = 0;
+  virtual int create_relative(const std::set<int>& rel_codes) = 0;
+  // Returns an fd yielding the input_event frames written to `dev`, or -1 if the sink
+  // cannot be observed. Blocking; owned by the caller.
+  virtual int open_reader(DeviceKind /*dev*/) { return -1; }
+};
+
+class UinputSink : public OutputSink {
+ public:
+  const char* describe() const override { return "uinput"; }
+  int create_gamepad(const std::set<int>& buttons, bool need_hat,
+                     const std::vector<AbsAxisSetup>& axes) override {
+    return create_uinput_gamepad(buttons, need_hat, axes);
+  }
+  int create_keyboard(const std::set<int>& keys) override { return create_uinput_keyboard(keys); }
+  int create_relative(const std::set<int>& rel_codes) override { return create_uinput_relative(rel_codes); }
+
+  // Finds the evdev node the kernel created for our virtual device by name.
+  int open_reader(DeviceKind dev) override {
+    const char* want = dev == DeviceKind::Gamepad    ? "gpio-virtual-gamepad"
+                       : dev == DeviceKind::Keyboard ? "gpio-virtual-keyboard"
+                                                     : "gpio-virtual-relative";
+    DIR* d = ::opendir("/dev/input");
+    if (!d) return -1;
+    int found = -1;
+    while (dirent* de = ::readdir(d)) {
+      if (std::strncmp(de->d_name, "event", 5) != 0) continue;
+      int fd = ::open((std::string("/dev/input/") + de->d_name).c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) continue;
+      char name[256] = "";
+      if (::ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0 && std::strcmp(name, want) == 0) {
+        found = fd;
+        break;
+      }
+      ::close(fd);
+    }
+    ::closedir(d);
+    return found;
+  }
+};
+
+class NullSink : public OutputSink {
+ public:
+  const char* describe() const override { return "null"; }
+  int create_gamepad(const std::set<int>&, bool, const std::vector<AbsAxisSetup>&) override {
+    return xopen("/dev/null", O_WRONLY | O_CLOEXEC);
+  }
+  int create_keyboard(const std::set<int>&) override { return xopen("/dev/null", O_WRONLY | O_CLOEXEC); }
+  int create_relative(const std::set<int>&) override { return xopen("/dev/null", O_WRONLY | O_CLOEXEC); }
+};
+
+class FakeSink : public OutputSink {
+ public:
+  const char* describe() const override { return "fake"; }
+  int create_gamepad(const std::set<int>&, bool, const std::vector<AbsAxisSetup>&) override {
+    return make_pipe(DeviceKind::Gamepad);
+  }
+  int create_keyboard(const std::set<int>&) override { return make_pipe(DeviceKind::Keyboard); }
+  int create_relative(const std::set<int>&) override { return make_pipe(DeviceKind::Relative); }
+  int open_reader(DeviceKind dev) override {
+    int& fd = read_fd_[(int)dev];
+    int r = fd;
+    fd = -1;  // handed over to the caller
+    return r;
+  }
+
+ private:
+  int make_pipe(DeviceKind dev) {
+    int p[2];
+    if (::pipe2(p, O_CLOEXEC) < 0) die("pipe2");
+    // The writer must never block the input thread; a large pipe keeps an idle reader
+    // from stalling it for a long while (a full pipe is a fatal write error).
+    (void)::fcntl(p[1], F_SETPIPE_SZ, 1 << 20);
+    if (::fcntl(p[1], F_SETFL, O_NONBLOCK) < 0) die("fcntl(O_NONBLOCK)");
+    read_fd_[(int)dev] = p[0];
+    return p[1];
+  }
+
+  int read_fd_[3] = {-1, -1, -1};  // by DeviceKind
+};
+
 // Auto-mapping mode for GPIOs not mentioned in the map file.
 enum class AutoMode { Buttons, Keys, None };
 
@@ -637,6 +1490,9 @@ static void print_options_and_exit() {
   std::cout
     << "Mapping targets (first column in map file):\n"
     << "  <gpio_offset>    -> numeric GPIO offset (e.g. 17)\n"
+    << "  chipN:<offset>   -> offset on the N-th --chip (e.g. chip1:3)\n"
+    << "  encoder A B OUT  -> quadrature encoder on lines A and B; OUT is REL_WHEEL,\n"
+    << "                      REL_HWHEEL, REL_DIAL, REL_MISC or two tokens (ccw cw)\n"
     << "  D2 .. D13        -> Arduino I2C digital pins (when --i2c-dev is used)\n"
     << "  I2C:D2 .. D13    -> explicit I2C notation; same as bare D#\n\n"
     << "Valid mapping tokens for this program:\n\n"
@@ -662,83 +1518,1556 @@ static void print_options_and_exit() {
   std::exit(0);
 }
 
-struct WatchedLine {
-  int req_fd;
-  uint32_t offset;
-  std::string name;
+// --- latency instrumentation ---
+//
+// Fixed-memory log-linear histograms (HdrHistogram layout): values below 2^kLatSubBits ns
+// are counted exactly, every power-of-two range above that is split into 2^kLatSubBits
+// linear sub-buckets, giving ~3% relative precision up to ~68 s with 4 KiB per histogram.
+
+static constexpr unsigned kLatSubBits = 5;
+static constexpr unsigned kLatMaxMagnitude = 36;  // values >= 2^36 ns are clamped
+static constexpr size_t kLatBuckets = (size_t)(kLatMaxMagnitude - kLatSubBits + 1) << kLatSubBits;
+
+struct LatencyHistogram {
+  uint32_t counts[kLatBuckets] = {};
+  uint64_t total = 0;
+  uint64_t max = 0;
 };
 
-struct I2cButtonBinding {
-  uint32_t pin;
-  Action action;
-};
+static size_t latency_bucket(uint64_t v) {
+  if (v >= (1ULL << kLatMaxMagnitude)) v = (1ULL << kLatMaxMagnitude) - 1;
+  if (v < (1ULL << kLatSubBits)) return (size_t)v;
+  unsigned mag = 63u - (unsigned)__builtin_clzll(v);
+  unsigned shift = mag - kLatSubBits;
+  size_t sub = (size_t)(v >> shift) - (1u << kLatSubBits);
+  return ((size_t)(mag - kLatSubBits + 1) << kLatSubBits) + sub;
+}
 
-struct I2cAnalogAxisState {
-  size_t raw_index;
-  std::string label;
-  uint16_t abs_code;
-  uint16_t min_seen = std::numeric_limits<uint16_t>::max();
-  uint16_t max_seen = 0;
-  bool initialized = false;
-  int last_scaled = -1;
-};
+// Highest value that lands in bucket `idx` (reported values are conservative).
+static uint64_t latency_bucket_upper(size_t idx) {
+  if (idx < (1u << kLatSubBits)) return idx;
+  size_t band = idx >> kLatSubBits;
+  size_t sub = idx & ((1u << kLatSubBits) - 1);
+  unsigned shift = (unsigned)(band - 1);
+  return (((uint64_t)(1u << kLatSubBits) + sub + 1) << shift) - 1;
+}
 
-struct I2cState {
-  bool enabled = false;
-  int fd = -1;
-  uint64_t interval_ns = 0;
-  uint64_t next_poll_ns = 0;
-  uint16_t last_mask = 0;
-  bool have_mask = false;
-  bool read_error_logged = false;
-  std::unordered_map<uint32_t, I2cButtonBinding> button_bits;  // keyed by bit index 0..11
-  std::vector<I2cAnalogAxisState> analogs;
+static void latency_record(LatencyHistogram& h, uint64_t v) {
+  h.counts[latency_bucket(v)]++;
+  h.total++;
+  if (v > h.max) h.max = v;
+}
+
+static uint64_t latency_percentile(const LatencyHistogram& h, double p) {
+  if (h.total == 0) return 0;
+  uint64_t want = (uint64_t)(p * (double)h.total);
+  if (want == 0) want = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kLatBuckets; i++) {
+    seen += h.counts[i];
+    if (seen >= want) return std::min(latency_bucket_upper(i), h.max);
+  }
+  return h.max;
+}
+
+enum LatencyStage { kLatEdgeToRead, kLatReadToDispatch, kLatDispatchToWrite, kLatEdgeToWrite, kLatStageCount };
+static const char* const kLatStageNames[kLatStageCount] = {
+  "edge->read", "read->dispatch", "dispatch->write", "edge->write",
 };
 
-struct I2cAnalogChannelDesc {
+// Histograms for one input source (GPIO line, I2C pin or I2C axis).
+struct SourceLatency {
   const char* label;
-  size_t raw_index;
-  uint16_t abs_code;
+  LatencyHistogram stages[kLatStageCount];
 };
 
-static constexpr size_t kI2cAnalogValueCount = 5;
-static constexpr size_t kI2cFrameBytes = (kI2cAnalogValueCount + 1) * sizeof(uint16_t);
-static constexpr uint16_t kI2cAnalogAdcMax = 1023;
-static constexpr uint16_t kI2cAnalogInitialSpan = 512;
-static constexpr uint16_t kI2cAnalogMinSpan = 32;
-
-static const I2cAnalogChannelDesc kDefaultI2cAnalogs[] = {
-  {"A0", 0, ABS_X},
-  {"A1", 1, ABS_Y},
-  {"A2", 2, ABS_RX},
-  {"A3", 3, ABS_RY},
-  {"A6", 4, ABS_Z},
+// Events dispatched since the last uinput flush; their write-complete stage is only
+// known once the frame has been written.
+struct LatencyBatch {
+  struct Pending {
+    SourceLatency* src;
+    uint64_t edge_ns, read_ns, dispatch_ns;
+  };
+  Pending items[256];
+  size_t count = 0;
 };
 
-int main(int argc, char** argv) {
-  std::string chip_path = "/dev/gpiochip0";
-  uint32_t start = 5;
-  uint32_t end = 27;
-  uint32_t debounce_us = 1000;
-  uint32_t event_buf_sz = 256;
-  std::string map_path;
-  std::string i2c_dev_path;
-  int i2c_addr = 0x42;
-  int i2c_interval_ms = 5;
-  bool i2c_log_samples = false;
-  bool i2c_disable_axes = false;
+static void latency_commit(LatencyBatch& b, uint64_t write_ns) {
+  for (size_t i = 0; i < b.count; i++) {
+    const auto& p = b.items[i];
+    auto span = [](uint64_t from, uint64_t to) { return to > from ? to - from : 0; };
+    latency_record(p.src->stages[kLatEdgeToRead], span(p.edge_ns, p.read_ns));
+    latency_record(p.src->stages[kLatReadToDispatch], span(p.read_ns, p.dispatch_ns));
+    latency_record(p.src->stages[kLatDispatchToWrite], span(p.dispatch_ns, write_ns));
+    latency_record(p.src->stages[kLatEdgeToWrite], span(p.edge_ns, write_ns));
+  }
+  b.count = 0;
+}
 
-  bool active_low = true;
-  AutoMode auto_mode = AutoMode::Buttons;
+static void latency_note(LatencyBatch& b, SourceLatency* src,
+                         uint64_t edge_ns, uint64_t read_ns, uint64_t dispatch_ns) {
+  if (!src) return;
+  if (b.count == sizeof(b.items) / sizeof(b.items[0])) latency_commit(b, dispatch_ns);
+  b.items[b.count++] = LatencyBatch::Pending{src, edge_ns, read_ns, dispatch_ns};
+}
 
-  {
-    sched_param sp{};
-    int prio = sched_get_priority_max(SCHED_FIFO);
-    if (prio < 1) prio = 1;
-    sp.sched_priority = prio;
-    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
-      std::cerr << "WARN: failed to set SCHED_FIFO priority (errno="
-                << errno << " " << std::strerror(errno) << ")\n";
+static void latency_dump(const std::deque<SourceLatency>& sources) {
+  std::fprintf(stderr, "latency report (us): p50 / p99 / p999 / max\n");
+  for (const auto& src : sources) {
+    if (src.stages[kLatEdgeToWrite].total == 0) continue;
+    for (int st = 0; st < kLatStageCount; st++) {
+      const LatencyHistogram& h = src.stages[st];
+      std::fprintf(stderr, "  %-28s %-16s n=%-8llu %9.1f %9.1f %9.1f %9.1f\n",
+                   src.label, kLatStageNames[st], (unsigned long long)h.total,
+                   latency_percentile(h, 0.50) / 1000.0,
+                   latency_percentile(h, 0.99) / 1000.0,
+                   latency_percentile(h, 0.999) / 1000.0,
+                   h.max / 1000.0);
+    }
+  }
+}
+
+// --- single-producer/single-consumer ring ---
+
+// Bounded lock-free ring between the input thread (producer) and one consumer thread.
+// push() never blocks; it fails when the ring is full and the caller counts the drop.
+template <typename T, size_t N>
+struct SpscRing {
+  static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of two");
+  T slots[N];
+  std::atomic<uint64_t> head{0};  // written by the producer only
+  std::atomic<uint64_t> tail{0};  // written by the consumer only
+
+  bool push(const T& v) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) return false;
+    slots[h & (N - 1)] = v;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // push() for a consumer that sleeps while the ring is empty: `was_empty` is set when
+  // the consumer may have seen the ring empty and has to be woken. The fence pairs with
+  // the one in writer_idle_wait().
+  bool push(const T& v, bool& was_empty) {
+    was_empty = false;
+    if (!push(v)) return false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    was_empty = tail.load(std::memory_order_relaxed) + 1 == head.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer side: hands every queued item to fn, then releases the slots.
+  template <typename Fn>
+  size_t drain(Fn&& fn) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    uint64_t h = head.load(std::memory_order_acquire);
+    for (uint64_t i = t; i != h; i++) fn(slots[i & (N - 1)]);
+    tail.store(h, std::memory_order_release);
+    return (size_t)(h - t);
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+};
+
+// Writer threads run behind the SCHED_FIFO input thread and never compete with it.
+static void lower_thread_priority() {
+  sched_param sp{};
+  pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+  setpriority(PRIO_PROCESS, 0, 10);
+}
+
+// An idle writer thread blocks on an eventfd instead of polling its ring. The producer
+// signals it only when a push finds the ring empty, so a burst of records costs one
+// write(). `stop` asks the writer to drain what is left, flush, and return for a join.
+struct WriterWake {
+  int fd = -1;  // eventfd
+  std::atomic<bool> stop{false};
+};
+
+static void writer_wake(WriterWake& w) {
+  uint64_t one = 1;
+  (void)!::write(w.fd, &one, sizeof(one));
+}
+
+// Consumer side, after a drain that found nothing: sleeps until the producer signals,
+// unless a record arrived after the drain.
+template <typename Ring>
+static void writer_idle_wait(WriterWake& w, const Ring& ring) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!ring.empty()) return;
+  pollfd p{w.fd, POLLIN, 0};
+  if (::poll(&p, 1, -1) > 0) {
+    uint64_t v;
+    (void)!::read(w.fd, &v, sizeof(v));
+  }
+}
+
+// Stops a writer thread once everything pushed so far is written.
+static void writer_stop(WriterWake& w, std::thread& t) {
+  if (!t.joinable()) return;
+  w.stop.store(true, std::memory_order_release);
+  writer_wake(w);
+  t.join();
+}
+
+// --- event log ---
+//
+// The input path never formats or writes log output itself. It pushes fixed-size
+// records into a single-producer/single-consumer ring, and a low-priority writer
+// thread drains the ring into text lines or a binary log. When the ring is full the
+// record is dropped and counted, so a slow SD card or a stalled pipe can never block
+// input delivery.
+
+enum class LogFormat { Text, Binary, None };
+enum class LogKind : uint8_t { Action, Unmapped, I2cRaw, I2cAxis, Dropped, Encoder, I2cWord };
+
+enum : uint8_t {
+  kLogPress = 1u << 0,
+  kLogHat = 1u << 1,
+  kLogFirst = 1u << 2,  // I2cAxis: first axis of a poll
+  kLogLast = 1u << 3,   // I2cAxis: last axis of a poll
+};
+
+struct LogRecord {
+  uint64_t t_ns;
+  LogKind kind;
+  uint8_t flags;
+  int8_t hat_x, hat_y;
+  uint16_t source;   // index into EventLogger::sources
+  uint16_t reserved;
+  int32_t code;      // EV_KEY code (Action), dropped count (Dropped), net detents (Encoder),
+                     // register value (I2cWord)
+  uint16_t v[6];     // I2cRaw: A0,A1,A2,A3,A6,mask  I2cAxis: raw,min,max,span,scaled
+};
+static_assert(sizeof(LogRecord) == 32, "LogRecord is part of the binary log format");
+
+// Static description of a record source, registered at startup.
+struct LogSource {
+  const char* origin;  // "offset=5 name=GPIO5", "i2c_pin=D3", "A0"
+  const char* token;   // action token, nullptr for unmapped pins / axes
+  const char* dev;     // "gamepad" / "keyboard", nullptr for hat or none
+};
+
+static constexpr size_t kLogRingSize = 4096;  // records; power of two
+
+struct EventLogger {
+  LogFormat format = LogFormat::Text;
+  FILE* out = stdout;
+  std::deque<LogSource> sources;  // frozen before the writer thread starts
+  SpscRing<LogRecord, kLogRingSize> ring;
+  std::atomic<uint64_t> dropped{0};
+  WriterWake wake;
+};
+
+static uint16_t log_add_source(EventLogger& lg, const char* origin, const char* token, const char* dev) {
+  lg.sources.push_back(LogSource{origin, token, dev});
+  return (uint16_t)(lg.sources.size() - 1);
+}
+
+static void log_push(EventLogger& lg, const LogRecord& r) {
+  if (lg.format == LogFormat::None) return;
+  bool was_empty;
+  if (!lg.ring.push(r, was_empty)) lg.dropped.fetch_add(1, std::memory_order_relaxed);
+  else if (was_empty) writer_wake(lg.wake);
+}
+
+static size_t log_format_text(const EventLogger& lg, const LogRecord& r, char* buf, size_t cap) {
+  const LogSource* src = (r.source < lg.sources.size()) ? &lg.sources[r.source] : nullptr;
+  const char* origin = src ? src->origin : "?";
+  const char* dir = (r.flags & kLogPress) ? "DOWN" : "UP";
+  int n = 0;
+  switch (r.kind) {
+    case LogKind::Action:
+      if (r.flags & kLogHat) {
+        n = std::snprintf(buf, cap, "t_ns=%llu %s token=%s -> %s (hat x=%d y=%d)\n",
+                          (unsigned long long)r.t_ns, origin, src ? src->token : "?", dir,
+                          r.hat_x, r.hat_y);
+      } else {
+        n = std::snprintf(buf, cap, "t_ns=%llu %s token=%s -> %s (dev=%s code=%d)\n",
+                          (unsigned long long)r.t_ns, origin, src ? src->token : "?", dir,
+                          (src && src->dev) ? src->dev : "?", r.code);
+      }
+      break;
+    case LogKind::Unmapped:
+      n = std::snprintf(buf, cap, "t_ns=%llu %s (unmapped) -> %s\n",
+                        (unsigned long long)r.t_ns, origin, dir);
+      break;
+    case LogKind::I2cRaw:
+      n = std::snprintf(buf, cap, "i2c_raw=%u,%u,%u,%u,%u dmask=0x%x\n",
+                        r.v[0], r.v[1], r.v[2], r.v[3], r.v[4], r.v[5]);
+      break;
+    case LogKind::I2cAxis:
+      n = std::snprintf(buf, cap, "%s %s raw=%u min=%u max=%u span=%u scaled=%d%s",
+                        (r.flags & kLogFirst) ? "i2c_axes:" : "", origin,
+                        r.v[0], r.v[1], r.v[2], r.v[3], (int)(int16_t)r.v[4],
+                        (r.flags & kLogLast) ? "\n" : "");
+      break;
+    case LogKind::Dropped:
+      n = std::snprintf(buf, cap, "log: dropped %d record(s) (ring full)\n", r.code);
+      break;
+    case LogKind::I2cWord:
+      n = std::snprintf(buf, cap, "t_ns=%llu %s word=%d (0x%04x)\n",
+                        (unsigned long long)r.t_ns, origin, r.code, (unsigned)r.code);
+      break;
+    case LogKind::Encoder:
+      n = std::snprintf(buf, cap, "t_ns=%llu %s token=%s -> %+d (dev=%s)\n",
+                        (unsigned long long)r.t_ns, origin, src ? src->token : "?", r.code,
+                        (src && src->dev) ? src->dev : "?");
+      break;
+  }
+  if (n < 0) return 0;
+  return std::min<size_t>((size_t)n, cap - 1);
+}
+
+static void log_write_binary_header(const EventLogger& lg) {
+  // "GTULOG01", record size, source count, then one fixed 96-byte entry per source.
+  uint32_t hdr[2] = {(uint32_t)sizeof(LogRecord), (uint32_t)lg.sources.size()};
+  std::fwrite("GTULOG01", 1, 8, lg.out);
+  std::fwrite(hdr, sizeof(hdr), 1, lg.out);
+  for (const auto& src : lg.sources) {
+    char entry[96] = {};
+    std::snprintf(entry, 48, "%s", src.origin ? src.origin : "");
+    std::snprintf(entry + 48, 32, "%s", src.token ? src.token : "");
+    std::snprintf(entry + 80, 16, "%s", src.dev ? src.dev : "");
+    std::fwrite(entry, sizeof(entry), 1, lg.out);
+  }
+  std::fflush(lg.out);
+}
+
+static void log_writer_main(EventLogger* lg) {
+  lower_thread_priority();
+
+  if (lg->format == LogFormat::Binary) log_write_binary_header(*lg);
+
+  static char chunk[32768];
+  uint64_t reported_dropped = 0;
+  for (;;) {
+    const bool stopping = lg->wake.stop.load(std::memory_order_acquire);
+    size_t len = 0;
+    lg->ring.drain([&](const LogRecord& r) {
+      if (sizeof(chunk) - len < 512) {
+        std::fwrite(chunk, 1, len, lg->out);
+        len = 0;
+      }
+      if (lg->format == LogFormat::Binary) {
+        std::memcpy(chunk + len, &r, sizeof(r));
+        len += sizeof(r);
+      } else {
+        len += log_format_text(*lg, r, chunk + len, sizeof(chunk) - len);
+      }
+    });
+
+    uint64_t dropped = lg->dropped.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      LogRecord d{};
+      d.kind = LogKind::Dropped;
+      d.t_ns = monotonic_ns();
+      d.code = (int32_t)(dropped - reported_dropped);
+      reported_dropped = dropped;
+      if (lg->format == LogFormat::Binary) {
+        std::memcpy(chunk + len, &d, sizeof(d));
+        len += sizeof(d);
+      } else {
+        len += log_format_text(*lg, d, chunk + len, sizeof(chunk) - len);
+      }
+    }
+
+    if (len > 0) {
+      std::fwrite(chunk, 1, len, lg->out);
+      std::fflush(lg->out);
+    } else if (stopping) {
+      return;  // everything pushed before the stop request is written
+    } else {
+      writer_idle_wait(lg->wake, lg->ring);
+    }
+  }
+}
+
+// --- record / replay ---
+//
+// --record captures every raw gpio_v2_line_event and every raw I2C frame, stamped with
+// the CLOCK_MONOTONIC time the read() returned, into a flat file of fixed 64-byte
+// records behind a 64-byte header, so the file can be mmap()ed and indexed directly.
+// A record's aux field depends on its type: GPIO events carry the index of the --chip
+// that reported them (replay dispatches on it), I2C frames the duration of the read.
+// Records go through an SPSC ring to a low-priority writer thread like the event log.
+// --replay feeds a capture back through the same debounce/mapping/emit pipeline.
+
+static constexpr uint32_t kTraceVersion = 1;
+static constexpr uint32_t kTraceHasI2c = 1u << 0;
+
+struct TraceHeader {
+  char magic[8];         // "GTUTRACE"
+  uint32_t version;
+  uint32_t record_size;
+  int32_t gpio_clock;    // clockid of gpio_v2_line_event.timestamp_ns
+  uint32_t flags;        // kTraceHasI2c
+  uint8_t reserved[40];
+};
+static_assert(sizeof(TraceHeader) == 64, "TraceHeader is part of the trace format");
+
+enum class TraceType : uint16_t { GpioEvent = 1, I2cFrame = 2 };
+
+struct TraceRecord {
+  uint64_t t_ns;         // CLOCK_MONOTONIC when the read() returned
+  TraceType type;
+  uint16_t len;          // payload bytes in use
+  uint32_t aux;          // GpioEvent: --chip index (0 in single-chip captures)
+                         // I2cFrame: duration of the read in ns
+  uint8_t payload[48];   // gpio_v2_line_event, or the raw I2C frame
+};
+static_assert(sizeof(TraceRecord) == 64, "TraceRecord is part of the trace format");
+static_assert(sizeof(gpio_v2_line_event) <= sizeof(TraceRecord::payload), "line event must fit");
+
+static constexpr size_t kTraceRingSize = 16384;  // records; power of two
+
+struct TraceWriter {
+  FILE* out = nullptr;
+  SpscRing<TraceRecord, kTraceRingSize> ring;
+  std::atomic<uint64_t> dropped{0};
+  WriterWake wake;
+};
+
+static void trace_push(TraceWriter* tw, uint64_t t_ns, TraceType type,
+                       const void* payload, size_t len, uint32_t aux) {
+  if (!tw) return;
+  TraceRecord r;
+  std::memset(&r, 0, sizeof(r));
+  r.t_ns = t_ns;
+  r.type = type;
+  r.len = (uint16_t)std::min(len, sizeof(r.payload));
+  r.aux = aux;
+  std::memcpy(r.payload, payload, r.len);
+  bool was_empty;
+  if (!tw->ring.push(r, was_empty)) tw->dropped.fetch_add(1, std::memory_order_relaxed);
+  else if (was_empty) writer_wake(tw->wake);
+}
+
+static void trace_writer_main(TraceWriter* tw) {
+  lower_thread_priority();
+  uint64_t reported_dropped = 0;
+  for (;;) {
+    const bool stopping = tw->wake.stop.load(std::memory_order_acquire);
+    size_t n = tw->ring.drain([&](const TraceRecord& r) { std::fwrite(&r, sizeof(r), 1, tw->out); });
+    uint64_t dropped = tw->dropped.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      std::fprintf(stderr, "WARN: --record dropped %llu record(s) (writer too slow)\n",
+                   (unsigned long long)(dropped - reported_dropped));
+      reported_dropped = dropped;
+    }
+    if (n > 0) std::fflush(tw->out);
+    else if (stopping) return;
+    else writer_idle_wait(tw->wake, tw->ring);
+  }
+}
+
+static TraceWriter* trace_open_writer(const std::string& path, clockid_t gpio_clock, bool has_i2c) {
+  auto* tw = new TraceWriter;
+  tw->out = std::fopen(path.c_str(), "wb");
+  if (!tw->out) die("open record file: " + path);
+  tw->wake.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (tw->wake.fd < 0) die("eventfd");
+  static char buf[1 << 16];
+  std::setvbuf(tw->out, buf, _IOFBF, sizeof(buf));
+
+  TraceHeader hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  std::memcpy(hdr.magic, "GTUTRACE", 8);
+  hdr.version = kTraceVersion;
+  hdr.record_size = sizeof(TraceRecord);
+  hdr.gpio_clock = (int32_t)gpio_clock;
+  hdr.flags = has_i2c ? kTraceHasI2c : 0;
+  std::fwrite(&hdr, sizeof(hdr), 1, tw->out);
+  std::fflush(tw->out);
+  return tw;
+}
+
+struct TraceFile {
+  const TraceHeader* hdr = nullptr;
+  const TraceRecord* records = nullptr;
+  size_t count = 0;
+};
+
+static TraceFile trace_map(const std::string& path) {
+  int fd = xopen(path, O_RDONLY | O_CLOEXEC);
+  off_t size = ::lseek(fd, 0, SEEK_END);
+  if (size < (off_t)sizeof(TraceHeader)) die("replay file too short: " + path);
+  void* base = ::mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) die("mmap(" + path + ")");
+  ::close(fd);
+
+  TraceFile tf;
+  tf.hdr = static_cast<const TraceHeader*>(base);
+  if (std::memcmp(tf.hdr->magic, "GTUTRACE", 8) != 0 || tf.hdr->version != kTraceVersion ||
+      tf.hdr->record_size != sizeof(TraceRecord)) {
+    errno = EINVAL;
+    die("not a gpio_to_uinput trace: " + path);
+  }
+  tf.records = reinterpret_cast<const TraceRecord*>(static_cast<const uint8_t*>(base) + sizeof(TraceHeader));
+  // A capture cut short by a kill can end in a partial record; ignore it.
+  tf.count = ((size_t)size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+  return tf;
+}
+
+// --- bench harness ---
+//
+// Drives one input line of a simulated backend and times each toggle until the matching
+// EV_KEY frame shows up on the sink's reader, i.e. the full edge -> dispatch -> write path.
+
+struct BenchConfig {
+  GpioBackend* backend = nullptr;
+  int reader_fd = -1;
+  uint32_t offset = 0;
+  int code = 0;
+  bool active_low = true;
+  uint64_t spacing_ns = 0;  // gap between toggles, so userspace debounce never drops one
+  int iterations = 0;
+};
+
+// xorshift64: reproducible pseudo-random workloads for the micro-benchmarks below.
+static uint64_t bench_rand(uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// Waits up to one second for an EV_KEY `code` == `value` on the reader; false on timeout.
+static bool bench_wait_key(int fd, int code, int value) {
+  input_event evs[64];
+  for (;;) {
+    pollfd p{fd, POLLIN, 0};
+    if (::poll(&p, 1, 1000) <= 0) return false;
+    ssize_t n = ::read(fd, evs, sizeof(evs));
+    if (n <= 0) return false;
+    for (size_t i = 0; i < (size_t)n / sizeof(input_event); i++) {
+      if (evs[i].type == EV_KEY && evs[i].code == code && evs[i].value == value) return true;
+    }
+  }
+}
+
+static void bench_main(BenchConfig cfg) {
+  LatencyHistogram hist;
+  size_t lost = 0;
+  usleep(100 * 1000);  // let the loop settle before the first edge
+  const uint64_t start_ns = monotonic_ns();
+  for (int i = 0; i < cfg.iterations; i++) {
+    const bool press = (i % 2) == 0;
+    const uint64_t t0 = monotonic_ns();
+    if (!cfg.backend->set_input_level(cfg.offset, press != cfg.active_low)) die("bench: drive line");
+    if (bench_wait_key(cfg.reader_fd, cfg.code, press ? 1 : 0)) latency_record(hist, monotonic_ns() - t0);
+    else lost++;
+    const uint64_t next = t0 + cfg.spacing_ns;
+    for (uint64_t now = monotonic_ns(); now < next; now = monotonic_ns()) {
+      usleep((useconds_t)std::max<uint64_t>(1, (next - now) / 1000));
+    }
+  }
+  const double elapsed_s = (double)(monotonic_ns() - start_ns) / 1e9;
+  std::fprintf(stderr,
+               "bench: %d toggles on offset %u, lost=%zu, %.0f toggles/s\n"
+               "bench: latency (us) p50=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+               cfg.iterations, (unsigned)cfg.offset, lost,
+               elapsed_s > 0 ? cfg.iterations / elapsed_s : 0.0,
+               latency_percentile(hist, 0.50) / 1000.0, latency_percentile(hist, 0.99) / 1000.0,
+               latency_percentile(hist, 0.999) / 1000.0, hist.max / 1000.0);
+  ::kill(::getpid(), SIGTERM);  // ends the event loop through the signalfd
+}
+
+struct WatchedLine {
+  int req_fd;
+  uint32_t chip;
+  uint32_t offset;
+  std::string name;
+};
+
+static constexpr uint16_t kNoIndex = 0xFFFF;
+
+// Per-line dispatch record, indexed directly by GPIO offset. Everything an edge needs
+// (resolved action, output fd, debounce strategy and state) sits in one cache line.
+struct alignas(64) LineSlot {
+  const Action* action = nullptr;  // nullptr: offset not watched
+  UinputFrame* out = nullptr;      // device frame for ButtonOrKey actions
+  SourceLatency* lat = nullptr;    // --latency-stats only
+  uint64_t last_accept_ns = 0;     // userspace debounce: last accepted edge (monotonic)
+  uint64_t deadline_ns = 0;        // pending debounce deadline (monotonic), 0 = not queued
+  uint32_t window_ns = 0;          // debounce window of this line
+  uint16_t log_src = 0;            // EventLogger source id
+  uint16_t req = kNoIndex;         // index of the owning LineRequest (GET_VALUES)
+  uint16_t dl_prev = kNoIndex;     // timer wheel bucket links (offsets)
+  uint16_t dl_next = kNoIndex;
+  uint16_t dl_bucket = 0;          // timer wheel bucket (level * 64 + slot)
+  DebounceStrategy debounce = DebounceStrategy::None;
+  uint8_t req_bit = 0;             // bit of this line in the request's value mask
+  uint8_t integ = 0;               // integrator: 0 (released) .. kIntegratorSteps (pressed)
+  bool active_low = true;          // falling edge = press
+  bool tap = false;                // single-edge line: each edge is a press + release
+  bool have_accept = false;
+  bool pressed = false;            // state last reported
+  bool level_press = false;        // level implied by the most recent edge
+  uint16_t enc = kNoIndex;         // index into the encoder table for A/B channel lines
+};
+static_assert(sizeof(LineSlot) == 64, "LineSlot should stay one cache line");
+
+// --bench-dispatch N: the per-edge lookup work of the LineSlot table against the hash
+// lookups it replaced (gpio_map.find(), last_accept_ns.find(), last_accept_ns[] = ts),
+// over one pseudo-random edge sequence on the watched lines with a lockout window.
+// Only dispatch is timed; nothing is emitted. Both paths must accept the same edges.
+static void bench_dispatch(const std::vector<LineSlot>& table, const std::unordered_map<uint32_t, Action>& gpio_map,
+                           const std::vector<std::pair<uint32_t, uint32_t>>& lines, uint64_t window_ns,
+                           int iterations) {
+  std::vector<uint32_t> pick((size_t)iterations);
+  std::vector<uint64_t> ts((size_t)iterations);
+  uint64_t rng = 0x9E3779B97F4A7C15ULL, t = 1000000000ULL;
+  for (int i = 0; i < iterations; i++) {
+    pick[(size_t)i] = (uint32_t)(bench_rand(rng) % lines.size());
+    t += bench_rand(rng) % (2 * window_ns / std::max<size_t>(1, lines.size()) + 1);
+    ts[(size_t)i] = t;
+  }
+
+  auto run_map = [&](uint64_t& accepted) {
+    std::unordered_map<uint32_t, uint64_t> last_accept_ns;
+    uint64_t sum = 0;
+    for (int i = 0; i < iterations; i++) {
+      const uint32_t key = lines[pick[(size_t)i]].first;
+      auto it = gpio_map.find(key);
+      if (it == gpio_map.end()) continue;
+      auto lt = last_accept_ns.find(key);
+      if (lt != last_accept_ns.end() && ts[(size_t)i] - lt->second < window_ns) continue;
+      last_accept_ns[key] = ts[(size_t)i];
+      const Action& act = it->second;
+      sum += (uint64_t)act.code + (act.dev == DeviceKind::Gamepad ? 1 : 2);
+      accepted++;
+    }
+    return sum;
+  };
+  auto run_table = [&](uint64_t& accepted) {
+    std::vector<LineSlot> t2(table);
+    uint64_t sum = 0;
+    for (int i = 0; i < iterations; i++) {
+      LineSlot& slot = t2[lines[pick[(size_t)i]].second];
+      if (!slot.action) continue;
+      if (slot.have_accept && ts[(size_t)i] - slot.last_accept_ns < window_ns) continue;
+      slot.last_accept_ns = ts[(size_t)i];
+      slot.have_accept = true;
+      sum += (uint64_t)slot.action->code + (slot.action->dev == DeviceKind::Gamepad ? 1 : 2);
+      accepted++;
+    }
+    return sum;
+  };
+  auto time_ns = [&](auto&& run, uint64_t& sum, uint64_t& accepted) {
+    accepted = 0;
+    run(accepted);  // warm-up: caches, branch predictors, first-touch allocations
+    accepted = 0;
+    const uint64_t t0 = monotonic_ns();
+    sum = run(accepted);
+    return (double)(monotonic_ns() - t0) / iterations;
+  };
+
+  uint64_t sum_map = 0, sum_table = 0, acc_map = 0, acc_table = 0;
+  const double ns_map = time_ns(run_map, sum_map, acc_map);
+  const double ns_table = time_ns(run_table, sum_table, acc_table);
+  std::fprintf(stderr,
+               "bench-dispatch: %zu lines, %d edges, %llu accepted, window %llu us\n"
+               "bench-dispatch: unordered_map %.1f ns/edge, line table %.1f ns/edge (%.1fx)%s\n",
+               lines.size(), iterations, (unsigned long long)acc_table, (unsigned long long)(window_ns / 1000),
+               ns_map, ns_table, ns_table > 0 ? ns_map / ns_table : 0.0,
+               sum_map == sum_table && acc_map == acc_table ? "" : " MISMATCH");
+  if (sum_map != sum_table || acc_map != acc_table) std::exit(1);
+}
+
+// --- quadrature encoders ---
+//
+// Each channel edge updates the pair's 2-bit AB state; kQuadStep[(prev << 2) | cur]
+// gives -1/0/+1, so bounce (a step forward and straight back) cancels out and an
+// impossible jump (both channels changed: a missed edge) counts as 0. Detents found in
+// one read() are summed and leave as one REL event (or a run of key pulses) per encoder
+// when the batch is flushed, with one log record instead of one per edge.
+
+static constexpr int8_t kQuadStep[16] = {
+   0, -1, +1,  0,
+  +1,  0,  0, -1,
+  -1,  0,  0, +1,
+   0, +1, -1,  0,
+};
+static constexpr uint64_t kEncoderAccelRefNs = 50ULL * 1000000ULL;  // slower detents: no accel
+static constexpr int kEncoderMaxPulses = 32;  // key pulses per encoder per batch
+
+struct Encoder {
+  const EncoderSpec* spec = nullptr;
+  UinputFrame* out = nullptr;
+  uint32_t line_a = 0;          // line_table index of channel A
+  uint64_t last_detent_ns = 0;  // for the velocity multiplier
+  int32_t pending = 0;          // detents (with acceleration) not yet emitted
+  int8_t acc = 0;               // transitions since the last detent
+  uint8_t ab = 0;               // current A (bit 1) and B (bit 0) levels
+  bool dirty = false;           // queued in the batch's dirty list
+  uint16_t log_src = 0;
+};
+
+// --- per-line timer wheel ---
+//
+// Pending per-line deadlines (settle windows, integrator samples, and anything else a
+// line needs to be woken for) live in a hierarchical timing wheel: 4 levels of 64
+// buckets with a 16.4 us tick (2^14 ns), covering ~1 ms, ~67 ms, ~4.3 s and ~275 s.
+// Nodes are the LineSlots themselves (intrusive uint16 links, no allocation); arm and
+// cancel are O(1), and a timer cascades down a level at most three times. Occupancy
+// bitmaps make the next expiry cheap to find, so one timerfd armed from it serves every
+// line. Deadlines round up to the next tick, never down.
+
+static constexpr unsigned kWheelTickShift = 14;
+static constexpr unsigned kWheelBits = 6;
+static constexpr unsigned kWheelSlots = 1u << kWheelBits;
+static constexpr unsigned kWheelLevels = 4;
+
+struct TimerWheel {
+  uint64_t now_tick = 0;                          // ticks below this have been processed
+  uint64_t occupied[kWheelLevels] = {};           // bit j: bucket j of the level non-empty
+  uint16_t heads[kWheelLevels][kWheelSlots];      // first LineSlot offset per bucket
+  TimerWheel() { for (auto& lvl : heads) for (auto& h : lvl) h = kNoIndex; }
+};
+
+static void wheel_link(std::vector<LineSlot>& t, TimerWheel& w, uint16_t off) {
+  LineSlot& s = t[off];
+  uint64_t tick = (s.deadline_ns + (1ULL << kWheelTickShift) - 1) >> kWheelTickShift;
+  if (tick < w.now_tick) tick = w.now_tick;
+  uint64_t delta = tick - w.now_tick;
+  unsigned level = 0;
+  while (level + 1 < kWheelLevels && delta >= (1ULL << (kWheelBits * (level + 1)))) level++;
+  if (delta >= (1ULL << (kWheelBits * kWheelLevels))) {
+    tick = w.now_tick + (1ULL << (kWheelBits * kWheelLevels)) - 1;  // beyond range: re-cascades
+  }
+  unsigned slot = (unsigned)(tick >> (kWheelBits * level)) & (kWheelSlots - 1);
+  uint16_t& head = w.heads[level][slot];
+  s.dl_bucket = (uint16_t)(level * kWheelSlots + slot);
+  s.dl_prev = kNoIndex;
+  s.dl_next = head;
+  if (head != kNoIndex) t[head].dl_prev = off;
+  head = off;
+  w.occupied[level] |= 1ULL << slot;
+}
+
+static void wheel_unlink(std::vector<LineSlot>& t, TimerWheel& w, uint16_t off) {
+  LineSlot& s = t[off];
+  const unsigned level = s.dl_bucket / kWheelSlots, slot = s.dl_bucket % kWheelSlots;
+  if (s.dl_prev != kNoIndex) t[s.dl_prev].dl_next = s.dl_next;
+  else w.heads[level][slot] = s.dl_next;
+  if (s.dl_next != kNoIndex) t[s.dl_next].dl_prev = s.dl_prev;
+  if (w.heads[level][slot] == kNoIndex) w.occupied[level] &= ~(1ULL << slot);
+  s.dl_prev = s.dl_next = kNoIndex;
+}
+
+static void deadline_cancel(std::vector<LineSlot>& t, TimerWheel& w, uint16_t off) {
+  if (t[off].deadline_ns == 0) return;
+  wheel_unlink(t, w, off);
+  t[off].deadline_ns = 0;
+}
+
+static void deadline_arm(std::vector<LineSlot>& t, TimerWheel& w, uint16_t off, uint64_t deadline_ns) {
+  deadline_cancel(t, w, off);
+  t[off].deadline_ns = deadline_ns;
+  wheel_link(t, w, off);
+}
+
+// First tick at which something is due or has to cascade; UINT64_MAX if the wheel is empty.
+static uint64_t wheel_next_tick(const TimerWheel& w) {
+  uint64_t best = UINT64_MAX;
+  for (unsigned level = 0; level < kWheelLevels; level++) {
+    if (!w.occupied[level]) continue;
+    const unsigned shift = kWheelBits * level;
+    const unsigned cur = (unsigned)(w.now_tick >> shift) & (kWheelSlots - 1);
+    // Level 0 is due at the current bucket. A higher level cascades its current bucket
+    // only when now_tick sits exactly on the bucket start (not yet processed).
+    const bool at_start = (w.now_tick & ((1ULL << shift) - 1)) == 0;
+    const unsigned from = (level == 0 || at_start) ? cur : cur + 1;
+    const uint64_t rot = from < kWheelSlots ? (w.occupied[level] >> from) : 0;
+    uint64_t round = (w.now_tick >> (shift + kWheelBits)) << (shift + kWheelBits);
+    unsigned j;
+    if (rot) {
+      j = from + (unsigned)__builtin_ctzll(rot);
+    } else {
+      j = (unsigned)__builtin_ctzll(w.occupied[level]);  // wraps into the next round
+      round += 1ULL << (shift + kWheelBits);
+    }
+    uint64_t tick = round + ((uint64_t)j << shift);
+    if (tick < w.now_tick) tick = w.now_tick;
+    best = std::min(best, tick);
+  }
+  return best;
+}
+
+// Absolute CLOCK_MONOTONIC time of wheel_next_tick(), 0 if the wheel is empty.
+static uint64_t wheel_next_ns(const TimerWheel& w) {
+  uint64_t tick = wheel_next_tick(w);
+  return tick == UINT64_MAX ? 0 : tick << kWheelTickShift;
+}
+
+// Processes every tick up to `now_ns`, calling fn(offset, deadline_ns) for each expired
+// line after unlinking it; fn may re-arm the line. Empty stretches are skipped.
+template <typename Fn>
+static void wheel_advance(std::vector<LineSlot>& t, TimerWheel& w, uint64_t now_ns, Fn&& fn) {
+  const uint64_t target = now_ns >> kWheelTickShift;
+  while (w.now_tick <= target) {
+    uint64_t next = wheel_next_tick(w);
+    if (next > target) {
+      w.now_tick = target + 1;
+      break;
+    }
+    w.now_tick = next;
+    // Cascade every level whose lower indices all wrapped to zero at this tick.
+    for (unsigned level = 1; level < kWheelLevels; level++) {
+      if ((w.now_tick & ((1ULL << (kWheelBits * level)) - 1)) != 0) break;
+      unsigned slot = (unsigned)(w.now_tick >> (kWheelBits * level)) & (kWheelSlots - 1);
+      uint16_t off = w.heads[level][slot];
+      w.heads[level][slot] = kNoIndex;
+      w.occupied[level] &= ~(1ULL << slot);
+      while (off != kNoIndex) {
+        uint16_t nxt = t[off].dl_next;
+        wheel_link(t, w, off);
+        off = nxt;
+      }
+    }
+    unsigned slot0 = (unsigned)w.now_tick & (kWheelSlots - 1);
+    uint16_t off = w.heads[0][slot0];
+    w.heads[0][slot0] = kNoIndex;
+    w.occupied[0] &= ~(1ULL << slot0);
+    w.now_tick++;  // before callbacks: a re-arm for "now" lands in the next tick
+    while (off != kNoIndex) {
+      uint16_t nxt = t[off].dl_next;
+      LineSlot& s = t[off];
+      uint64_t deadline_ns = s.deadline_ns;
+      s.dl_prev = s.dl_next = kNoIndex;
+      s.deadline_ns = 0;
+      fn(off, deadline_ns);
+      off = nxt;
+    }
+  }
+}
+
+// --- timer wheel benchmark ---
+//
+// --bench-wheel N runs one pseudo-random workload of N operations (arm a line's deadline,
+// cancel one, advance the clock and expire) against the wheel and against an indexed
+// binary min-heap, the usual O(log n) alternative. Expiry callbacks re-arm a quarter of
+// the lines (like integrator sampling), and the ns/op of both are printed. The same
+// workload is then run through both with the heap keyed by the wheel's tick rounding, and
+// every advance has to expire the same (line, deadline) set, in non-decreasing tick order.
+
+struct DeadlineHeap {
+  std::vector<std::pair<uint64_t, uint16_t>> h;  // (deadline, line)
+  std::vector<uint32_t> pos;                     // line -> index in h, UINT32_MAX if not queued
+
+  explicit DeadlineHeap(size_t lines) : pos(lines, UINT32_MAX) { h.reserve(lines); }
+  void place(size_t i) { pos[h[i].second] = (uint32_t)i; }
+  void up(size_t i) {
+    while (i > 0 && h[i].first < h[(i - 1) / 2].first) {
+      std::swap(h[i], h[(i - 1) / 2]);
+      place(i);
+      i = (i - 1) / 2;
+    }
+    place(i);
+  }
+  void down(size_t i) {
+    for (;;) {
+      size_t m = i;
+      const size_t l = 2 * i + 1, r = l + 1;
+      if (l < h.size() && h[l].first < h[m].first) m = l;
+      if (r < h.size() && h[r].first < h[m].first) m = r;
+      if (m == i) break;
+      std::swap(h[i], h[m]);
+      place(i);
+      i = m;
+    }
+    place(i);
+  }
+  void cancel(uint16_t line) {
+    const uint32_t i = pos[line];
+    if (i == UINT32_MAX) return;
+    pos[line] = UINT32_MAX;
+    if (i + 1 == h.size()) {
+      h.pop_back();
+      return;
+    }
+    const uint16_t moved = h.back().second;
+    h[i] = h.back();
+    h.pop_back();
+    up(i);
+    down(pos[moved]);
+  }
+  void arm(uint16_t line, uint64_t deadline) {
+    cancel(line);
+    h.emplace_back(deadline, line);
+    up(h.size() - 1);
+  }
+  template <typename Fn>
+  void advance(uint64_t now, Fn&& fn) {
+    while (!h.empty() && h[0].first <= now) {
+      const uint16_t line = h[0].second;
+      cancel(line);
+      fn(line);
+    }
+  }
+};
+
+static void bench_wheel(int ops) {
+  constexpr uint16_t kLines = 512;
+  constexpr uint64_t kRearmNs = 250000;  // integrator-style follow-up sample
+  struct Op {
+    uint8_t kind;  // 0 arm, 1 cancel, 2 advance
+    uint16_t line;
+    uint64_t delta_ns;
+  };
+  std::vector<Op> work((size_t)ops);
+  uint64_t rng = 0x2545F4914F6CDD1DULL;
+  for (auto& op : work) {
+    const uint64_t r = bench_rand(rng) % 10;
+    op.kind = r < 5 ? 0 : r < 7 ? 1 : 2;
+    op.line = (uint16_t)(bench_rand(rng) % kLines);
+    if (op.kind == 0) {
+      // Mostly debounce windows (up to 20 ms), sometimes hold/turbo-like timeouts (up to 2 s).
+      op.delta_ns = bench_rand(rng) % 10 ? bench_rand(rng) % 20000000ULL : bench_rand(rng) % 2000000000ULL;
+    } else {
+      op.delta_ns = bench_rand(rng) % 2000000ULL;
+    }
+  }
+  auto rearm = [](uint64_t deadline) { return ((deadline >> kWheelTickShift) & 3) == 0; };
+  const uint64_t start_ns = 1000000000000ULL;
+
+  // exact: heap keyed by the wheel's rounded-up tick and advanced to whole ticks.
+  auto run_heap = [&](bool exact, std::vector<std::vector<std::pair<uint16_t, uint64_t>>>* fired) {
+    DeadlineHeap heap(kLines);
+    std::vector<uint64_t> deadline(kLines, 0);
+    const uint64_t round = (1ULL << kWheelTickShift) - 1;
+    auto key = [&](uint64_t d) { return exact ? ((d + round) >> kWheelTickShift) << kWheelTickShift : d; };
+    uint64_t now = start_ns, sum = 0;
+    std::vector<std::pair<uint16_t, uint64_t>>* out = nullptr;
+    auto fire = [&](uint16_t line) {
+      const uint64_t d = deadline[line];
+      sum += line;
+      if (out) out->emplace_back(line, d);
+      if (rearm(d)) {
+        deadline[line] = d + kRearmNs;
+        heap.arm(line, key(deadline[line]));
+      }
+    };
+    for (const Op& op : work) {
+      if (op.kind == 0) {
+        deadline[op.line] = now + op.delta_ns;
+        heap.arm(op.line, key(deadline[op.line]));
+      } else if (op.kind == 1) {
+        heap.cancel(op.line);
+      } else {
+        now += op.delta_ns;
+        if (fired) {
+          fired->emplace_back();
+          out = &fired->back();
+        }
+        heap.advance(exact ? (now >> kWheelTickShift) << kWheelTickShift : now, fire);
+      }
+    }
+    return sum;
+  };
+  auto run_wheel = [&](std::vector<std::vector<std::pair<uint16_t, uint64_t>>>* fired) {
+    std::vector<LineSlot> t(kLines);
+    TimerWheel w;
+    w.now_tick = start_ns >> kWheelTickShift;
+    uint64_t now = start_ns, sum = 0;
+    std::vector<std::pair<uint16_t, uint64_t>>* out = nullptr;
+    for (const Op& op : work) {
+      if (op.kind == 0) {
+        deadline_arm(t, w, op.line, now + op.delta_ns);
+      } else if (op.kind == 1) {
+        deadline_cancel(t, w, op.line);
+      } else {
+        now += op.delta_ns;
+        if (fired) {
+          fired->emplace_back();
+          out = &fired->back();
+        }
+        wheel_advance(t, w, now, [&](uint16_t line, uint64_t d) {
+          sum += line;
+          if (out) out->emplace_back(line, d);
+          if (rearm(d)) deadline_arm(t, w, line, d + kRearmNs);
+        });
+      }
+    }
+    return sum;
+  };
+
+  auto time_ns = [&](auto&& run) {
+    run();  // warm-up
+    const uint64_t t0 = monotonic_ns();
+    volatile uint64_t sink = run();
+    (void)sink;
+    return (double)(monotonic_ns() - t0) / ops;
+  };
+  const double ns_wheel = time_ns([&] { return run_wheel(nullptr); });
+  const double ns_heap = time_ns([&] { return run_heap(false, nullptr); });
+  std::fprintf(stderr,
+               "bench-wheel: %u lines, %d ops (50%% arm, 20%% cancel, 30%% advance)\n"
+               "bench-wheel: timer wheel %.1f ns/op, binary heap %.1f ns/op (%.1fx)\n",
+               (unsigned)kLines, ops, ns_wheel, ns_heap, ns_wheel > 0 ? ns_heap / ns_wheel : 0.0);
+
+  std::vector<std::vector<std::pair<uint16_t, uint64_t>>> by_wheel, by_heap;
+  run_wheel(&by_wheel);
+  run_heap(true, &by_heap);
+  size_t expiries = 0;
+  for (size_t a = 0; a < by_wheel.size(); a++) {
+    auto& fw = by_wheel[a];
+    auto& fh = by_heap[a];
+    for (size_t k = 1; k < fw.size(); k++) {
+      const uint64_t prev = (fw[k - 1].second + (1ULL << kWheelTickShift) - 1) >> kWheelTickShift;
+      const uint64_t cur = (fw[k].second + (1ULL << kWheelTickShift) - 1) >> kWheelTickShift;
+      if (cur < prev) {
+        std::fprintf(stderr, "bench-wheel: ordering check FAILED: advance %zu expired tick %llu after %llu\n", a,
+                     (unsigned long long)cur, (unsigned long long)prev);
+        std::exit(1);
+      }
+    }
+    std::sort(fw.begin(), fw.end());
+    std::sort(fh.begin(), fh.end());
+    if (fw != fh) {
+      std::fprintf(stderr, "bench-wheel: ordering check FAILED: advance %zu expired %zu line(s), heap %zu\n", a,
+                   fw.size(), fh.size());
+      std::exit(1);
+    }
+    expiries += fw.size();
+  }
+  std::fprintf(stderr, "bench-wheel: ordering check: %zu expiries over %zu advances match the heap\n", expiries,
+               by_wheel.size());
+}
+
+// Arms (or with 0, disarms) an absolute CLOCK_MONOTONIC timerfd; -1 is a no-op (replay).
+static void timerfd_arm_abs(int fd, uint64_t deadline_ns) {
+  if (fd < 0) return;
+  itimerspec its{};
+  its.it_value.tv_sec = (time_t)(deadline_ns / 1000000000ULL);
+  its.it_value.tv_nsec = (long)(deadline_ns % 1000000000ULL);
+  if (::timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr) < 0) die("timerfd_settime");
+}
+
+// One kernel line request (and fd) covering up to GPIO_V2_LINES_MAX offsets.
+struct LineRequest {
+  int fd;
+  std::vector<uint32_t> offsets;
+  EventSource source;
+  uint32_t last_seqno = 0;  // kernel numbers a request's events 1, 2, ...; a gap is an overflow
+  uint32_t chip = 0;        // index into the --chip list (and the backends)
+  uint32_t base = 0;        // line_table index of the chip's offset 0
+  // Polled requests (chip without edge detection): sampled with GET_VALUES, not in the loop.
+  bool polled = false;
+  uint64_t last_bits = 0;     // last sampled levels, bit i = offsets[i]
+  uint64_t rising_mask = 0;   // lines that want rising / falling edges synthesized
+  uint64_t falling_mask = 0;
+};
+
+// A chip's line-info watch fd, registered in the loop while some mapped line on it is
+// still held by another consumer.
+struct ChipWatch {
+  uint32_t chip;
+  EventSource source;
+  bool registered = false;
+  uint32_t waiting = 0;  // watched busy lines not claimed yet; the watch stops at 0
+};
+
+// Opens the I2C bus and selects the co-processor; -1 (with a warning) if the bus is not
+// there yet or the address cannot be claimed.
+static int open_i2c_bus(const std::string& path, int addr) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "WARN: cannot open " << path << " (" << std::strerror(errno) << ")\n";
+    return -1;
+  }
+  if (::ioctl(fd, I2C_SLAVE, addr) < 0) {
+    std::cerr << "WARN: I2C_SLAVE on " << path << " failed (" << std::strerror(errno) << ")\n";
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// How long the GPIO poller stays at the fast rate after the last change it saw.
+static constexpr uint64_t kGpioPollHoldNs = 500ULL * 1000000ULL;
+
+static constexpr uint32_t kI2cDigitalBitCount = 12;  // D2..D13
+
+struct I2cButtonBinding {
+  const Action* action = nullptr;  // nullptr: pin not mapped
+  UinputFrame* out = nullptr;
+  char origin[16] = "";            // "i2c_pin=Dn", formatted at startup
+  SourceLatency* lat = nullptr;    // --latency-stats only
+  uint16_t log_src = 0;            // EventLogger source id
+};
+
+struct I2cAnalogAxisState {
+  size_t raw_index;
+  std::string label;
+  uint16_t abs_code;
+  uint16_t min_seen = std::numeric_limits<uint16_t>::max();
+  uint16_t max_seen = 0;
+  bool initialized = false;
+  int last_scaled = -1;
+  SourceLatency* lat = nullptr;    // --latency-stats only
+  uint16_t log_src = 0;            // EventLogger source id
+};
+
+struct I2cState {
+  bool enabled = false;
+  bool attached = false;  // the sampler holds an open bus fd
+  uint32_t gen = 0;       // bumped on every attach/detach; older frames are discarded
+  uint16_t last_mask = 0;
+  bool have_mask = false;
+  I2cButtonBinding button_bits[kI2cDigitalBitCount];  // indexed by bit (pin - 2)
+  size_t mapped_bits = 0;
+  std::vector<I2cAnalogAxisState> analogs;
+};
+
+struct I2cAnalogChannelDesc {
+  const char* label;
+  size_t raw_index;
+  uint16_t abs_code;
+};
+
+static constexpr size_t kI2cAnalogValueCount = 5;
+static constexpr size_t kI2cFrameBytes = (kI2cAnalogValueCount + 1) * sizeof(uint16_t);
+static constexpr uint16_t kI2cAnalogAdcMax = 1023;
+static constexpr uint16_t kI2cAnalogInitialSpan = 512;
+static constexpr uint16_t kI2cAnalogMinSpan = 32;
+
+static const I2cAnalogChannelDesc kDefaultI2cAnalogs[] = {
+  {"A0", 0, ABS_X},
+  {"A1", 1, ABS_Y},
+  {"A2", 2, ABS_RX},
+  {"A3", 3, ABS_RY},
+  {"A6", 4, ABS_Z},
+};
+
+// --- I2C sampler thread ---
+//
+// The bus is read by a thread of its own, so a slow transfer (a 12-byte read at 100 kHz
+// takes over a millisecond), clock stretching or a stalled bus never delays GPIO edges.
+// The sampler owns the bus fd: the input thread opens it and hands it over through
+// `control`, and only the sampler closes it, so a detach cannot race a read in flight.
+// Frames travel back through an SPSC ring and an eventfd that the main loop waits on
+// like any other source. The ring is a mailbox of whole-state snapshots: if the input
+// thread falls behind, the newest frames are dropped and the next one catches up.
+
+// Each poll is one I2C_RDWR transaction: the frame register, and when due the --i2c-words
+// SMBus word registers, each addressed with a register write and a repeated-start read.
+// That keeps frame reads apart from the battery scripts' SBS reads on the same address.
+// A sketch without the frame register answers 0xFFFF; such frames fail
+// i2c_frame_plausible() and are dropped. A run of kI2cImplausibleLimit of them drops the
+// sampler back to plain read()s of the frame, and register reads are retried every
+// kI2cRegisterRetryNs so a single glitch cannot bring back the frame/SBS race for good.
+static constexpr uint8_t kI2cFrameRegister = 0x80;
+static constexpr uint32_t kI2cImplausibleLimit = 8;
+static constexpr uint64_t kI2cRegisterRetryNs = 10ULL * 1000000000ULL;
+static constexpr size_t kI2cMaxWords = 8;  // up to 6 from --i2c-words + the battery's 2
+static constexpr uint64_t kI2cWordsPeriodNs = 1000ULL * 1000000ULL;  // --i2c-words alone
+
+// --- battery monitor ---
+//
+// --battery replaces the i2ctransfer shell pollers. The SBS Voltage (0x09, mV) and
+// RelativeStateOfCharge (0x0D, %) words ride along with an input poll every
+// --battery-interval-s, in the same I2C_RDWR transaction. That means no forks and no
+// second bus master on the address. A SOC word above 100 (not implemented) falls back
+// to the voltage curve. The result is smoothed with an EMA and written to the fake
+// power_supply/BAT0 tree or to the test_power module parameters. All of it runs on the
+// sampler thread, so the input thread never touches these files.
+
+enum class BatteryTarget { None, PowerSupply, TestPower };
+
+struct BatteryMonitor {
+  BatteryTarget target = BatteryTarget::None;
+  std::string dir;           // BAT0 directory or test_power parameters directory
+  double alpha = 0.25;       // EMA weight of a new reading; 1 = no smoothing
+  uint64_t interval_ns = 0;  // --battery-interval-s
+  uint64_t next_ns = 0;
+  size_t mv_word = 0;        // indexes into I2cSample::words
+  size_t soc_word = 0;
+  double soc_ema = -1.0;     // < 0: no reading yet
+  bool error_logged = false;
+  std::atomic<uint32_t> last_mv{0};
+  std::atomic<int32_t> last_soc{-1};
+};
+
+static constexpr uint8_t kSbsVoltage = 0x09;
+static constexpr uint8_t kSbsRelativeSoc = 0x0D;
+
+// Single-cell Li-ion open-circuit curve, linear in between (volts, percent).
+static constexpr float kSocCurve[][2] = {
+  {3.00f, 0},  {3.30f, 5},  {3.50f, 10}, {3.60f, 20}, {3.65f, 25}, {3.70f, 35},
+  {3.75f, 45}, {3.80f, 55}, {3.85f, 65}, {3.90f, 75}, {3.95f, 82}, {4.00f, 88},
+  {4.05f, 93}, {4.10f, 97}, {4.15f, 99}, {4.20f, 100},
+};
+
+static double soc_from_voltage(double v) {
+  constexpr size_t n = sizeof(kSocCurve) / sizeof(kSocCurve[0]);
+  if (v <= kSocCurve[0][0]) return kSocCurve[0][1];
+  if (v >= kSocCurve[n - 1][0]) return kSocCurve[n - 1][1];
+  size_t i = 1;
+  while (v > kSocCurve[i][0]) i++;
+  const double t = (v - kSocCurve[i - 1][0]) / (kSocCurve[i][0] - kSocCurve[i - 1][0]);
+  return kSocCurve[i - 1][1] + t * (kSocCurve[i][1] - kSocCurve[i - 1][1]);
+}
+
+static void battery_update(BatteryMonitor& b, uint64_t now_ns, uint16_t mv, uint16_t soc_word) {
+  if (now_ns < b.next_ns) return;  // --i2c-words may fetch the registers more often
+  b.next_ns = now_ns + b.interval_ns;
+  const double raw = soc_word <= 100 ? soc_word : soc_from_voltage(mv / 1000.0);
+  b.soc_ema = b.soc_ema < 0 ? raw : b.alpha * raw + (1.0 - b.alpha) * b.soc_ema;
+  const int soc = (int)std::lround(std::min(100.0, std::max(0.0, b.soc_ema)));
+
+  // Stop at the first failed write so the warning names that file and its errno.
+  char buf[160];
+  std::string failed;
+  int err = 0;
+  auto put = [&](const char* name, const char* text, bool create) {
+    if (!failed.empty()) return;
+    std::string path = b.dir + name;
+    if (write_text_file(path, text, create)) return;
+    err = errno;
+    failed = std::move(path);
+  };
+  if (b.target == BatteryTarget::PowerSupply) {
+    put("/type", "Battery\n", true);
+    put("/present", "1\n", true);
+    std::snprintf(buf, sizeof(buf), "%d\n", soc);
+    put("/capacity", buf, true);
+    put("/status", soc >= 100 ? "Full\n" : "Discharging\n", true);
+    std::snprintf(buf, sizeof(buf), "POWER_SUPPLY_NAME=BAT0\nPOWER_SUPPLY_TYPE=Battery\n"
+                  "POWER_SUPPLY_CAPACITY=%d\nPOWER_SUPPLY_VOLTAGE_NOW=%u\n", soc, (unsigned)mv * 1000U);
+    put("/uevent", buf, true);
+  } else {
+    std::snprintf(buf, sizeof(buf), "%d\n", soc);
+    put("/battery_capacity", buf, false);
+    std::snprintf(buf, sizeof(buf), "%u\n", (unsigned)mv);
+    put("/battery_voltage", buf, false);
+  }
+  if (!failed.empty() && !b.error_logged) {
+    std::cerr << "WARN: battery: cannot write " << failed << " (" << std::strerror(err) << ")\n";
+  }
+  b.error_logged = !failed.empty();
+  b.last_mv.store(mv, std::memory_order_relaxed);
+  b.last_soc.store(soc, std::memory_order_relaxed);
+}
+
+struct I2cSample {
+  uint8_t bytes[kI2cFrameBytes];
+  uint32_t gen;            // I2cState::gen the bus was attached under
+  uint64_t poll_start_ns;  // CLOCK_MONOTONIC before the read()
+  uint64_t read_done_ns;   // CLOCK_MONOTONIC after the read()
+  uint16_t words[kI2cMaxWords];  // --i2c-words values, valid when nwords > 0
+  uint8_t nwords;
+};
+
+static constexpr size_t kI2cMailboxSize = 16;  // frames; power of two
+
+// Adaptive poll rate: any change keeps the sampler at --i2c-interval-ms; after
+// --i2c-hold-ms without one the period doubles per poll up to --i2c-idle-ms. Axis
+// jitter below kI2cActivityCounts is not activity, or ADC noise would pin the fast rate.
+static constexpr int kI2cActivityCounts = 4;
+
+static bool i2c_frame_active(const uint8_t* prev, const uint8_t* cur) {
+  for (size_t i = 0; i < kI2cAnalogValueCount; i++) {
+    if (std::abs((int)get_u16_le(&cur[i * 2]) - (int)get_u16_le(&prev[i * 2])) > kI2cActivityCounts) return true;
+  }
+  return get_u16_le(&cur[kI2cAnalogValueCount * 2]) != get_u16_le(&prev[kI2cAnalogValueCount * 2]);
+}
+
+struct I2cSampler {
+  std::atomic<uint64_t> control{0};  // (gen << 32) | fd, fd 0xffffffff = no bus
+  int wake_fd = -1;                  // eventfd: control changed (input thread -> sampler)
+  int ready_fd = -1;                 // eventfd: frames queued (sampler -> input thread)
+  uint16_t addr = 0;
+  bool frame_register = true;        // --i2c-read register (default) or plain
+  std::vector<uint8_t> word_regs;    // --i2c-words (+ battery registers)
+  uint64_t words_period_ns = kI2cWordsPeriodNs;
+  BatteryMonitor* battery = nullptr; // --battery, fed from word_regs
+  uint64_t interval_ns = 0;          // active poll period (watchdog period with --i2c-irq)
+  uint64_t idle_ns = 0;              // longest period after backing off (= interval_ns: fixed)
+  uint64_t hold_ns = 0;              // quiet time before backing off
+  std::atomic<uint64_t> period_ns{0};  // period in use, for the statistics
+  std::atomic<uint64_t> kick_ns{0};  // data-ready edge (CLOCK_MONOTONIC) to serve, 0 = none
+  int cpu = -1;                      // --i2c-cpu, -1 = not pinned
+  SpscRing<I2cSample, kI2cMailboxSize> mailbox;
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> read_errors{0};
+};
+
+// Pins the calling thread to one CPU. A CPU that is offline or outside the cpuset only
+// produces a warning.
+static void pin_thread_to_cpu(int cpu, const char* what) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    std::cerr << "WARN: cannot pin " << what << " to CPU " << cpu << " (" << std::strerror(err) << ")\n";
+  }
+}
+
+// Data-ready line asserted: read a frame now instead of at the next poll.
+static void i2c_sampler_kick(I2cSampler& s, uint64_t edge_ns) {
+  s.kick_ns.store(edge_ns ? edge_ns : 1, std::memory_order_release);
+  uint64_t one = 1;
+  (void)!::write(s.wake_fd, &one, sizeof(one));
+}
+
+// Hands a new bus fd (or -1) to the sampler; it closes the previous one itself.
+static void i2c_sampler_set_bus(I2cSampler& s, uint32_t gen, int fd) {
+  s.control.store(((uint64_t)gen << 32) | (uint32_t)fd, std::memory_order_release);
+  uint64_t one = 1;
+  (void)!::write(s.wake_fd, &one, sizeof(one));
+}
+
+static bool i2c_frame_plausible(const uint8_t* frame) {
+  for (size_t i = 0; i < kI2cAnalogValueCount; i++) {
+    if (get_u16_le(&frame[i * 2]) > kI2cAnalogAdcMax) return false;
+  }
+  return get_u16_le(&frame[kI2cAnalogValueCount * 2]) < (1u << kI2cDigitalBitCount);
+}
+
+// Register reads as one I2C_RDWR transaction (frame may be nullptr, regs may be empty).
+static bool i2c_read_registers(int fd, uint16_t addr, uint8_t* frame, const std::vector<uint8_t>& regs,
+                               uint16_t* words) {
+  i2c_msg msgs[2 * (1 + kI2cMaxWords)];
+  uint8_t cmd[1 + kI2cMaxWords];
+  uint8_t raw[kI2cMaxWords][2];
+  uint32_t n = 0;
+  auto add = [&](uint8_t& reg, uint8_t* dst, uint16_t len) {
+    msgs[n++] = i2c_msg{addr, 0, 1, &reg};
+    msgs[n++] = i2c_msg{addr, I2C_M_RD, len, dst};
+  };
+  size_t c = 0;
+  if (frame) {
+    cmd[c] = kI2cFrameRegister;
+    add(cmd[c++], frame, kI2cFrameBytes);
+  }
+  for (size_t w = 0; w < regs.size(); w++) {
+    cmd[c] = regs[w];
+    add(cmd[c++], raw[w], 2);
+  }
+  if (n == 0) return true;
+  i2c_rdwr_ioctl_data xfer{msgs, n};
+  if (::ioctl(fd, I2C_RDWR, &xfer) != (int)n) return false;
+  for (size_t w = 0; w < regs.size(); w++) words[w] = get_u16_le(raw[w]);
+  return true;
+}
+
+static void i2c_sampler_main(I2cSampler* s) {
+  // One step below the input thread: a GPIO wakeup on a shared CPU preempts a poll.
+  sched_param sp{};
+  sp.sched_priority = std::max(1, sched_get_priority_max(SCHED_FIFO) - 1);
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+  if (s->cpu >= 0) pin_thread_to_cpu(s->cpu, "I2C sampler");
+
+  int fd = -1;
+  uint32_t gen = 0;
+  uint64_t next_ns = 0;
+  uint64_t period_ns = s->interval_ns;
+  uint64_t last_active_ns = 0;
+  uint8_t prev[kI2cFrameBytes];
+  bool have_prev = false;
+  bool error_logged = false;
+  bool frame_register = s->frame_register;
+  bool rdwr = true;  // cleared once the adapter turns I2C_RDWR down
+  uint32_t implausible = 0;        // consecutive register frames that failed the check
+  uint64_t register_retry_ns = 0;  // next register-mode probe after a fallback, 0 = none
+  bool fallback_logged = false;
+  uint64_t next_words_ns = 0;
+  static const std::vector<uint8_t> no_regs;
+  s->period_ns.store(period_ns, std::memory_order_relaxed);
+  for (;;) {
+    const uint64_t ctl = s->control.load(std::memory_order_acquire);
+    if ((uint32_t)(ctl >> 32) != gen) {
+      if (fd >= 0) ::close(fd);
+      gen = (uint32_t)(ctl >> 32);
+      fd = (int)(uint32_t)ctl;
+      next_ns = monotonic_ns();
+      have_prev = false;
+      error_logged = false;
+      frame_register = s->frame_register;  // the sketch may have been updated meanwhile
+      rdwr = true;
+      implausible = 0;
+      register_retry_ns = 0;
+      fallback_logged = false;
+      next_words_ns = 0;
+    }
+
+    const uint64_t now = monotonic_ns();
+    if (fd < 0 || (now < next_ns && s->kick_ns.load(std::memory_order_acquire) == 0)) {
+      // Sleep until the next poll is due, or indefinitely while detached; a control
+      // change or a data-ready kick wakes us either way.
+      timespec ts{};
+      if (fd >= 0) ts = timespec{(time_t)((next_ns - now) / 1000000000ULL), (long)((next_ns - now) % 1000000000ULL)};
+      pollfd p{s->wake_fd, POLLIN, 0};
+      if (::ppoll(&p, 1, fd >= 0 ? &ts : nullptr, nullptr) > 0) {
+        uint64_t v;
+        (void)!::read(s->wake_fd, &v, sizeof(v));
+      }
+      continue;
+    }
+
+    // A kick taken here and re-raised during the read gets a read of its own. Its edge
+    // time stands in for the poll start, so latency counts from the Arduino's signal.
+    const uint64_t kick_ns = s->kick_ns.exchange(0, std::memory_order_acq_rel);
+    I2cSample smp;
+    smp.gen = gen;
+    smp.poll_start_ns = kick_ns != 0 && kick_ns <= now ? kick_ns : now;
+    if (register_retry_ns != 0 && rdwr && now >= register_retry_ns) {
+      // Probe the frame register again; one bad frame sends us straight back to plain reads.
+      frame_register = true;
+      register_retry_ns = 0;
+      implausible = kI2cImplausibleLimit - 1;
+    }
+    const bool words_due = rdwr && !s->word_regs.empty() && now >= next_words_ns;
+    const std::vector<uint8_t>& regs = words_due ? s->word_regs : no_regs;
+    auto rdwr_refused = [&]() {
+      if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL) return false;
+      std::cerr << "WARN: I2C adapter rejects I2C_RDWR; plain frame reads, no register words\n";
+      rdwr = frame_register = false;
+      return true;
+    };
+    bool ok;
+    bool words_ok = false;
+    if (frame_register) {
+      ok = i2c_read_registers(fd, s->addr, smp.bytes, regs, smp.words);
+      if (!ok && rdwr_refused()) continue;
+      if (ok && !i2c_frame_plausible(smp.bytes)) {
+        s->read_errors.fetch_add(1, std::memory_order_relaxed);
+        if (++implausible < kI2cImplausibleLimit) continue;  // glitch: drop the frame, read again
+        if (!fallback_logged) {
+          std::cerr << "WARN: co-processor has no frame register 0x" << std::hex << (int)kI2cFrameRegister
+                    << std::dec << " (old arduino.ino?); using plain reads, retrying every "
+                    << kI2cRegisterRetryNs / 1000000000ULL << " s\n";
+          fallback_logged = true;
+        }
+        frame_register = false;
+        register_retry_ns = now + kI2cRegisterRetryNs;
+        continue;
+      }
+      if (ok && fallback_logged) {
+        std::cerr << "Co-processor frame register 0x" << std::hex << (int)kI2cFrameRegister << std::dec
+                  << " answers again; register reads resumed\n";
+        fallback_logged = false;
+      }
+      if (ok) implausible = 0;
+      words_ok = ok && words_due;
+    } else {
+      const ssize_t n = ::read(fd, smp.bytes, sizeof(smp.bytes));
+      ok = n == (ssize_t)sizeof(smp.bytes);
+      if (n >= 0 && !ok) errno = EIO;  // short frame
+      if (ok && words_due && !i2c_read_registers(fd, s->addr, nullptr, regs, smp.words)) {
+        if (!rdwr_refused()) s->read_errors.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        words_ok = ok && words_due;
+      }
+    }
+    smp.nwords = words_ok ? (uint8_t)regs.size() : 0;
+    if (words_due) next_words_ns = now + s->words_period_ns;
+    smp.read_done_ns = monotonic_ns();
+    next_ns = now + period_ns;
+    if (!ok) {
+      s->read_errors.fetch_add(1, std::memory_order_relaxed);
+      if (!error_logged) {
+        std::cerr << "WARN: I2C read failed (" << std::strerror(errno) << ")\n";
+        error_logged = true;
+      }
+      continue;
+    }
+    error_logged = false;
+
+    if (!have_prev || i2c_frame_active(prev, smp.bytes)) {
+      last_active_ns = smp.read_done_ns;
+      period_ns = s->interval_ns;
+    } else if (period_ns < s->idle_ns && smp.read_done_ns - last_active_ns >= s->hold_ns) {
+      period_ns = std::min(period_ns * 2, s->idle_ns);
+    }
+    std::memcpy(prev, smp.bytes, sizeof(prev));
+    have_prev = true;
+    next_ns = now + period_ns;
+    s->period_ns.store(period_ns, std::memory_order_relaxed);
+
+    if (s->mailbox.push(smp)) {
+      s->frames.fetch_add(1, std::memory_order_relaxed);
+      uint64_t one = 1;
+      (void)!::write(s->ready_fd, &one, sizeof(one));
+    } else {
+      s->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    // After the frame is on its way: publishing touches the filesystem.
+    if (s->battery && smp.nwords) {
+      battery_update(*s->battery, smp.read_done_ns, smp.words[s->battery->mv_word],
+                     smp.words[s->battery->soc_word]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> chip_paths;  // --chip may repeat; empty means /dev/gpiochip0
+  uint32_t start = 5;
+  uint32_t end = 27;
+  uint32_t debounce_us = 1000;
+  DebounceStrategy debounce_strategy = DebounceStrategy::Settle;
+  uint32_t event_buf_sz = 256;
+  std::string map_path;
+  std::string i2c_dev_path;
+  int i2c_addr = 0x42;
+  int i2c_interval_ms = 5;
+  bool i2c_frame_register = true;   // --i2c-read register|plain
+  std::vector<uint8_t> i2c_words;   // --i2c-words: extra SMBus word registers
+  BatteryTarget battery_target = BatteryTarget::None;  // --battery
+  std::string battery_dir;     // --battery-dir, default per target
+  int battery_interval_s = 15;
+  double battery_alpha = 0.25;
+  int i2c_idle_ms = 50;        // adaptive poll: slowest period once idle
+  int i2c_hold_ms = 500;       // adaptive poll: quiet time before backing off
+  bool i2c_log_samples = false;
+  bool i2c_disable_axes = false;
+  std::string i2c_irq;         // --i2c-irq: data-ready line ("17" / "chipN:17")
+  int i2c_watchdog_ms = 250;   // poll period while --i2c-irq is in use
+  int input_cpu = -1;  // --cpu: pin the input thread
+  int i2c_cpu = -1;    // --i2c-cpu: pin the I2C sampler thread
+  bool per_line_requests = false;
+  uint32_t gpio_poll_us = 1000;       // polled fallback rate after activity (0 = no fallback)
+  uint32_t gpio_poll_idle_us = 10000; // polled fallback rate when idle
+  LoopBackend loop_backend = LoopBackend::Epoll;
+  uint64_t gpio_clock_flags = 0;          // kernel edge timestamp source (0 = CLOCK_MONOTONIC)
+  clockid_t gpio_clock = CLOCK_MONOTONIC; // domain of gpio_v2_line_event.timestamp_ns
+  bool kernel_event_time = false;         // stamp input_events with the edge time, not write time
+  std::optional<clockid_t> uinput_clock_arg;  // --uinput-clock; default depends on --event-time
+  bool latency_stats = false;
+  LogFormat log_format = LogFormat::Text;
+  std::string log_path;
+  std::string record_path;
+  std::string replay_path;
+  bool replay_max_speed = false;
+  bool bench_debounce = false;  // --bench-debounce: replay once per strategy
+  BackendKind backend_kind = BackendKind::Chardev;
+  SinkKind sink_kind = SinkKind::Uinput;
+  int bench_iterations = 0;
+  int bench_dispatch_edges = 0;
+  int bench_wheel_ops = 0;
+
+  bool active_low = true;
+  AutoMode auto_mode = AutoMode::Buttons;
+
+  // Give stdout a static buffer so the first event log line does not allocate one.
+  static char stdout_buf[BUFSIZ];
+  std::setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+  {
+    sched_param sp{};
+    int prio = sched_get_priority_max(SCHED_FIFO);
+    if (prio < 1) prio = 1;
+    sp.sched_priority = prio;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
+      std::cerr << "WARN: failed to set SCHED_FIFO priority (errno="
+                << errno << " " << std::strerror(errno) << ")\n";
     }
   }
 
@@ -749,11 +3078,83 @@ int main(int argc, char** argv) {
       return argv[++i];
     };
 
-    if (a == "--chip") chip_path = need("--chip");
+    if (a == "--chip") chip_paths.push_back(need("--chip"));
     else if (a == "--start") start = (uint32_t)std::stoul(need("--start"));
     else if (a == "--end") end = (uint32_t)std::stoul(need("--end"));
-    else if (a == "--debounce-us") debounce_us = (uint32_t)std::stoul(need("--debounce-us"));
+    else if (a == "--debounce-us") {
+      const unsigned long v = std::stoul(need("--debounce-us"));
+      if (v > kMaxDebounceUs) die("--debounce-us is limited to " + std::to_string(kMaxDebounceUs));
+      debounce_us = (uint32_t)v;
+    }
+    else if (a == "--debounce") {
+      auto d = parse_debounce_strategy(need("--debounce"));
+      if (!d) die("bad --debounce value (use settle|lockout|integrator|none)");
+      debounce_strategy = *d;
+    }
     else if (a == "--event-buf") event_buf_sz = (uint32_t)std::stoul(need("--event-buf"));
+    else if (a == "--per-line-requests") per_line_requests = true;
+    else if (a == "--gpio-poll-us") gpio_poll_us = (uint32_t)std::stoul(need("--gpio-poll-us"));
+    else if (a == "--gpio-poll-idle-us") gpio_poll_idle_us = (uint32_t)std::stoul(need("--gpio-poll-idle-us"));
+    else if (a == "--gpio-clock") {
+      std::string v = upper(trim(need("--gpio-clock")));
+      if (v == "MONOTONIC") { gpio_clock_flags = 0; gpio_clock = CLOCK_MONOTONIC; }
+      else if (v == "REALTIME") { gpio_clock_flags = GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME; gpio_clock = CLOCK_REALTIME; }
+      // HTE providers report hardware timestamps on the monotonic timeline.
+      else if (v == "HTE") { gpio_clock_flags = GPIO_V2_LINE_FLAG_EVENT_CLOCK_HTE; gpio_clock = CLOCK_MONOTONIC; }
+      else die("bad --gpio-clock value (use monotonic|realtime|hte)");
+    }
+    else if (a == "--event-time") {
+      std::string v = upper(trim(need("--event-time")));
+      if (v == "KERNEL") kernel_event_time = true;
+      else if (v == "WRITE") kernel_event_time = false;
+      else die("bad --event-time value (use kernel|write)");
+    }
+    else if (a == "--uinput-clock") {
+      auto clk = parse_clock_name(upper(trim(need("--uinput-clock"))));
+      if (!clk) die("bad --uinput-clock value (use realtime|monotonic|boottime)");
+      uinput_clock_arg = *clk;
+    }
+    else if (a == "--latency-stats") latency_stats = true;
+    else if (a == "--log") {
+      std::string v = upper(trim(need("--log")));
+      if (v == "TEXT") log_format = LogFormat::Text;
+      else if (v == "BINARY") log_format = LogFormat::Binary;
+      else if (v == "NONE") log_format = LogFormat::None;
+      else die("bad --log value (use text|binary|none)");
+    }
+    else if (a == "--log-file") log_path = need("--log-file");
+    else if (a == "--record") record_path = need("--record");
+    else if (a == "--replay") replay_path = need("--replay");
+    else if (a == "--replay-speed") {
+      std::string v = upper(trim(need("--replay-speed")));
+      if (v == "ORIGINAL") replay_max_speed = false;
+      else if (v == "MAX") replay_max_speed = true;
+      else die("bad --replay-speed value (use original|max)");
+    }
+    else if (a == "--bench-debounce") bench_debounce = true;
+    else if (a == "--backend") {
+      std::string v = upper(trim(need("--backend")));
+      if (v == "CHARDEV") backend_kind = BackendKind::Chardev;
+      else if (v == "GPIO-SIM") backend_kind = BackendKind::GpioSim;
+      else if (v == "FAKE") backend_kind = BackendKind::Fake;
+      else die("bad --backend value (use chardev|gpio-sim|fake)");
+    }
+    else if (a == "--sink") {
+      std::string v = upper(trim(need("--sink")));
+      if (v == "UINPUT") sink_kind = SinkKind::Uinput;
+      else if (v == "NULL") sink_kind = SinkKind::Null;
+      else if (v == "FAKE") sink_kind = SinkKind::Fake;
+      else die("bad --sink value (use uinput|null|fake)");
+    }
+    else if (a == "--bench") bench_iterations = std::max(1, std::stoi(need("--bench")));
+    else if (a == "--bench-dispatch") bench_dispatch_edges = std::max(1, std::stoi(need("--bench-dispatch")));
+    else if (a == "--bench-wheel") bench_wheel_ops = std::max(1, std::stoi(need("--bench-wheel")));
+    else if (a == "--loop") {
+      std::string v = upper(trim(need("--loop")));
+      if (v == "EPOLL") loop_backend = LoopBackend::Epoll;
+      else if (v == "POLL") loop_backend = LoopBackend::Poll;
+      else die("bad --loop value (use epoll|poll)");
+    }
     else if (a == "--map") map_path = need("--map");
     else if (a == "--i2c-dev") i2c_dev_path = need("--i2c-dev");
     else if (a == "--i2c-addr") {
@@ -761,9 +3162,43 @@ int main(int argc, char** argv) {
       i2c_addr = (int)std::stoul(v, nullptr, 0);
     }
     else if (a == "--i2c-interval-ms") i2c_interval_ms = std::max(1, std::stoi(need("--i2c-interval-ms")));
+    else if (a == "--i2c-read") {
+      std::string v = upper(trim(need("--i2c-read")));
+      if (v == "REGISTER") i2c_frame_register = true;
+      else if (v == "PLAIN") i2c_frame_register = false;
+      else die("bad --i2c-read value (use register|plain)");
+    }
+    else if (a == "--i2c-words") {
+      std::stringstream list(need("--i2c-words"));
+      for (std::string item; std::getline(list, item, ',');) {
+        const unsigned long reg = std::stoul(trim(item), nullptr, 0);
+        if (reg > 0xFF) die("bad --i2c-words register: " + item);
+        i2c_words.push_back((uint8_t)reg);
+      }
+      if (i2c_words.size() > kI2cMaxWords - 2) die("--i2c-words takes at most 6 registers");
+    }
+    else if (a == "--battery") {
+      std::string v = upper(trim(need("--battery")));
+      if (v == "BAT0") battery_target = BatteryTarget::PowerSupply;
+      else if (v == "TEST-POWER") battery_target = BatteryTarget::TestPower;
+      else if (v == "NONE") battery_target = BatteryTarget::None;
+      else die("bad --battery value (use bat0|test-power|none)");
+    }
+    else if (a == "--battery-dir") battery_dir = need("--battery-dir");
+    else if (a == "--battery-interval-s") battery_interval_s = std::max(1, std::stoi(need("--battery-interval-s")));
+    else if (a == "--battery-alpha") {
+      battery_alpha = std::stod(need("--battery-alpha"));
+      if (!(battery_alpha > 0.0 && battery_alpha <= 1.0)) die("--battery-alpha must be in (0, 1]");
+    }
+    else if (a == "--i2c-idle-ms") i2c_idle_ms = std::max(1, std::stoi(need("--i2c-idle-ms")));
+    else if (a == "--i2c-hold-ms") i2c_hold_ms = std::max(0, std::stoi(need("--i2c-hold-ms")));
     else if (a == "--active-high") active_low = false;
     else if (a == "--i2c-log") i2c_log_samples = true;
     else if (a == "--i2c-no-axes") i2c_disable_axes = true;
+    else if (a == "--i2c-irq") i2c_irq = need("--i2c-irq");
+    else if (a == "--i2c-watchdog-ms") i2c_watchdog_ms = std::max(1, std::stoi(need("--i2c-watchdog-ms")));
+    else if (a == "--cpu") input_cpu = std::stoi(need("--cpu"));
+    else if (a == "--i2c-cpu") i2c_cpu = std::stoi(need("--i2c-cpu"));
     else if (a == "--auto") {
       std::string v = upper(trim(need("--auto")));
       if (v == "BUTTONS") auto_mode = AutoMode::Buttons;
@@ -775,29 +3210,127 @@ int main(int argc, char** argv) {
     } else {
       std::cerr
         << "Usage:\n"
-        << "  " << argv[0] << " [--chip /dev/gpiochipN] [--start N] [--end N]\n"
-        << "             [--debounce-us N] [--event-buf N] [--map path] [--active-high]\n"
+        << "  " << argv[0] << " [--chip /dev/gpiochipN]... [--start N] [--end N]\n"
+        << "             [--debounce-us N] [--debounce settle|lockout|integrator|none]\n"
+        << "             [--event-buf N] [--per-line-requests]\n"
+        << "             [--gpio-poll-us N] [--gpio-poll-idle-us N]\n"
+        << "             [--map path] [--active-high] [--loop epoll|poll]\n"
+        << "             [--gpio-clock monotonic|realtime|hte] [--event-time kernel|write]\n"
+        << "             [--uinput-clock realtime|monotonic|boottime] [--latency-stats]\n"
+        << "             [--log text|binary|none] [--log-file path]\n"
+        << "             [--record file] [--replay file] [--replay-speed original|max] [--bench-debounce]\n"
+        << "             [--backend chardev|gpio-sim|fake] [--sink uinput|null|fake] [--bench N]\n"
+        << "             [--bench-dispatch N] [--bench-wheel N]\n"
         << "             [--i2c-dev /dev/i2c-X] [--i2c-addr 0x42] [--i2c-interval-ms N]\n"
-        << "             [--i2c-log] [--i2c-no-axes]\n"
+        << "             [--i2c-read register|plain] [--i2c-words REG,...]\n"
+        << "             [--battery bat0|test-power|none] [--battery-dir path]\n"
+        << "             [--battery-interval-s N] [--battery-alpha A]\n"
+        << "             [--i2c-idle-ms N] [--i2c-hold-ms N] [--i2c-irq line] [--i2c-watchdog-ms N]\n"
+        << "             [--i2c-log] [--i2c-no-axes] [--cpu N] [--i2c-cpu N]\n"
         << "             [--auto buttons|keys|none] [--list-options]\n\n"
         << "Defaults: chip=/dev/gpiochip0 start=2 end=27 debounce-us=10000 auto=buttons\n";
       return 2;
     }
   }
 
-  int chip_fd = xopen(chip_path, O_RDONLY | O_CLOEXEC);
-
-  gpiochip_info cinfo;
-  std::memset(&cinfo, 0, sizeof(cinfo));
-  if (ioctl(chip_fd, GPIO_GET_CHIPINFO_IOCTL, &cinfo) < 0) die("GPIO_GET_CHIPINFO_IOCTL");
+  if (bench_wheel_ops > 0) {
+    bench_wheel(bench_wheel_ops);
+    return 0;
+  }
 
-  if (end >= cinfo.lines) end = cinfo.lines - 1;
+  // uinput on kernels >= 5.4 takes an injected input_event.time as CLOCK_MONOTONIC, so
+  // kernel edge stamps default to that domain; realtime stays available when asked for.
+  const clockid_t uinput_clock = uinput_clock_arg.value_or(kernel_event_time ? CLOCK_MONOTONIC : CLOCK_REALTIME);
 
   // Build mapping.
+  if (chip_paths.empty()) chip_paths.push_back("/dev/gpiochip0");
+  const uint32_t num_chips = (uint32_t)chip_paths.size();
   MappingResult mapping =
       map_path.empty() ? default_mapping_from_your_log() : load_mapping_file(map_path);
   auto& gpio_map = mapping.gpio;
   auto& i2c_button_map = mapping.i2c_digital;
+  for (auto it = gpio_map.begin(); it != gpio_map.end();) {
+    if (key_chip(it->first) < num_chips) {
+      ++it;
+      continue;
+    }
+    std::cerr << "WARN: map uses chip" << key_chip(it->first) << " but only " << num_chips
+              << " --chip option(s) were given; ignoring chip" << key_chip(it->first) << ":"
+              << key_offset(it->first) << "\n";
+    it = gpio_map.erase(it);
+  }
+
+  if (bench_debounce && replay_path.empty()) die("--bench-debounce needs --replay");
+  if (battery_target != BatteryTarget::None && i2c_dev_path.empty() && replay_path.empty()) {
+    die("--battery needs --i2c-dev");
+  }
+
+  // --i2c-irq: the Arduino pulls this line low (open drain, our pull-up) while it has a
+  // frame the host has not read. Only the asserting edge is requested.
+  std::optional<uint32_t> i2c_irq_key;
+  if (!i2c_irq.empty()) {
+    if (i2c_dev_path.empty() && replay_path.empty()) die("--i2c-irq needs --i2c-dev");
+    i2c_irq_key = parse_gpio_key(i2c_irq);
+    if (!i2c_irq_key || key_chip(*i2c_irq_key) >= num_chips) die("bad --i2c-irq line: " + i2c_irq);
+    if (gpio_map.count(*i2c_irq_key)) std::cerr << "WARN: --i2c-irq replaces the map entry for " << i2c_irq << "\n";
+    gpio_map[*i2c_irq_key] = Action{ActionType::I2cIrq, DeviceKind::Gamepad, 0, HatDir::Up, "I2C_IRQ"};
+    LineConfig cfg;
+    cfg.bias = GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    cfg.active_low = true;
+    cfg.edges = LineEdges::Press;
+    cfg.debounce_us = 0;
+    cfg.kernel_debounce_us = 0;
+    mapping.gpio_cfg[*i2c_irq_key] = cfg;
+  }
+
+  // Signals are consumed through a signalfd in the loop; block them before any helper
+  // thread starts so every thread inherits the mask and none takes the default action.
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGUSR1);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  if (sigprocmask(SIG_BLOCK, &sigs, nullptr) < 0) die("sigprocmask");
+
+  // Replay runs without hardware: the capture stands in for the chips and the I2C bus.
+  // Simulated backends get enough lines to cover the range (first chip) and every mapped
+  // offset. Each chip's lines occupy one contiguous run of the dispatch table.
+  const bool replaying = !replay_path.empty();
+  TraceFile replay;
+  std::vector<uint32_t> chip_lines(num_chips, 1);
+  chip_lines[0] = end + 1;
+  for (const auto& kv : gpio_map) {
+    chip_lines[key_chip(kv.first)] = std::max(chip_lines[key_chip(kv.first)], key_offset(kv.first) + 1);
+  }
+  // A chardev chip that is not there yet keeps a null backend and the map-derived size;
+  // it is attached when its node shows up in /dev.
+  std::vector<std::unique_ptr<GpioBackend>> backends;  // one per --chip; empty when replaying
+  if (replaying) {
+    replay = trace_map(replay_path);
+    gpio_clock = (clockid_t)replay.hdr->gpio_clock;
+  } else {
+    for (uint32_t c = 0; c < num_chips; c++) {
+      switch (backend_kind) {
+        case BackendKind::Chardev: backends.push_back(ChardevBackend::try_open(chip_paths[c])); break;
+        case BackendKind::GpioSim: backends.push_back(std::make_unique<GpioSimBackend>(chip_lines[c])); break;
+        case BackendKind::Fake: backends.push_back(std::make_unique<FakeBackend>(chip_lines[c])); break;
+      }
+      if (backends[c]) chip_lines[c] = backends[c]->num_lines();
+      else std::cerr << "WARN: cannot open " << chip_paths[c] << " (" << std::strerror(errno)
+                     << "); waiting for it to appear\n";
+    }
+  }
+  if (bench_iterations > 0 && (backends.empty() || backend_kind == BackendKind::Chardev))
+    die("--bench needs a simulated backend (--backend gpio-sim|fake)");
+  std::vector<uint32_t> chip_base(num_chips, 0);
+  uint32_t total_lines = 0;
+  for (uint32_t c = 0; c < num_chips; c++) {
+    chip_base[c] = total_lines;
+    total_lines += chip_lines[c];
+  }
+  if (total_lines >= kNoIndex) die("too many GPIO lines across --chip options");
+
+  if (end >= chip_lines[0]) end = chip_lines[0] - 1;
 
   // Auto-assign unmapped offsets in range.
   std::vector<uint32_t> candidates;
@@ -840,45 +3373,231 @@ int main(int argc, char** argv) {
     }
   }
 
-  // Request GPIO lines (skip used/consumer/output).
-  std::vector<WatchedLine> watched;
-  watched.reserve(gpio_map.size());
+  // Request GPIO lines (skip used/consumer/output). --start/--end and the exclusions
+  // apply to the first chip; other chips contribute the lines the map names.
+  std::vector<std::vector<uint32_t>> eligible(num_chips);  // chip-local offsets
+  std::unordered_map<uint32_t, std::string> line_names;     // by line_key()
+  std::vector<uint32_t> busy;                               // line_key()s held by someone else
+  std::vector<uint32_t> absent;                             // line_key()s on chips not there yet
 
   for (const auto& kv : gpio_map) {
-    uint32_t off = kv.first;
-    if (off < start || off > end) continue;
-    if (is_excluded(off)) continue;
+    const uint32_t chip = key_chip(kv.first);
+    const uint32_t off = key_offset(kv.first);
+    if (off >= chip_lines[chip]) continue;
+    if (chip == 0 && (off < start || off > end) && kv.first != i2c_irq_key) continue;
+    if (chip == 0 && is_excluded(off)) continue;
+    if (replaying) {
+      eligible[chip].push_back(off);
+      continue;
+    }
+    if (!backends[chip]) {
+      absent.push_back(kv.first);
+      continue;
+    }
 
-    auto infoOpt = get_line_info(chip_fd, off);
+    auto infoOpt = backends[chip]->line_info(off);
     if (!infoOpt) continue;
     auto info = *infoOpt;
 
+    line_names[kv.first] = (info.name[0] ? info.name : "");
     bool used_flag = (info.flags & GPIO_V2_LINE_FLAG_USED);
     bool is_output = (info.flags & GPIO_V2_LINE_FLAG_OUTPUT);
     bool has_consumer = (info.consumer[0] != '\0');
-    if (used_flag || has_consumer || is_output) continue;
+    if (used_flag || has_consumer || is_output) {
+      busy.push_back(kv.first);
+      continue;
+    }
+
+    eligible[chip].push_back(off);
+  }
+  for (auto& lines : eligible) std::sort(lines.begin(), lines.end());
+
+  // Per-line settings from the map (by line_key()), falling back to the command-line defaults.
+  auto line_config = [&](uint32_t key) {
+    auto it = mapping.gpio_cfg.find(key);
+    return it != mapping.gpio_cfg.end() ? it->second : LineConfig{};
+  };
+  auto kernel_config = [&](uint32_t key) {
+    LineConfig cfg = line_config(key);
+    const bool low = cfg.active_low.value_or(active_low);
+    const uint64_t press_edge = low ? GPIO_V2_LINE_FLAG_EDGE_FALLING : GPIO_V2_LINE_FLAG_EDGE_RISING;
+    const uint64_t release_edge = low ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    LineKernelConfig k;
+    k.flags = GPIO_V2_LINE_FLAG_INPUT | cfg.bias.value_or(GPIO_V2_LINE_FLAG_BIAS_PULL_UP) |
+              edge_flags_for(cfg.edges.value_or(LineEdges::Both), press_edge, release_edge) |
+              gpio_clock_flags;  // EVENT_CLOCK_REALTIME / EVENT_CLOCK_HTE, or 0 for CLOCK_MONOTONIC
+    k.debounce_us = cfg.kernel_debounce_us.value_or(debounce_us);
+    return k;
+  };
+
+  // Pack eligible lines into as few requests as possible (GPIO_V2_LINES_MAX per request,
+  // and per-line settings must fit the request's attribute slots). If a batch is rejected
+  // (e.g. one line lacks edge support), retry its lines one by one so a single bad line
+  // does not take the others down with it.
+  std::deque<LineRequest> requests;  // deque: EventSource addresses must stay stable
+  std::vector<size_t> free_requests;   // entries left by detached chips, reused first
+  std::vector<size_t> added_requests;  // entries filled by add_request() since last cleared
+  std::vector<WatchedLine> watched;
+
+  const size_t batch_max = per_line_requests ? 1 : GPIO_V2_LINES_MAX;
+  auto add_request = [&](uint32_t chip, int fd, std::vector<uint32_t> offs, bool polled) {
+    LineRequest fresh{fd, std::move(offs), EventSource{SourceKind::GpioRequest, fd, nullptr}};
+    size_t r = requests.size();
+    if (free_requests.empty()) {
+      requests.push_back(std::move(fresh));
+    } else {
+      r = free_requests.back();
+      free_requests.pop_back();
+      requests[r] = std::move(fresh);
+    }
+    added_requests.push_back(r);
+    LineRequest& req = requests[r];
+    req.source.ctx = &req;
+    req.chip = chip;
+    req.base = chip_base[chip];
+    req.polled = polled;
+    for (size_t bit = 0; polled && bit < req.offsets.size(); bit++) {
+      uint64_t edges = kernel_config(line_key(chip, req.offsets[bit])).flags;
+      if (edges & GPIO_V2_LINE_FLAG_EDGE_RISING) req.rising_mask |= 1ULL << bit;
+      if (edges & GPIO_V2_LINE_FLAG_EDGE_FALLING) req.falling_mask |= 1ULL << bit;
+    }
+    return r;
+  };
+  // Polled lines are plain inputs: no edge detection, hence no event clock or kernel debounce.
+  auto polled_config = [&](uint32_t key) {
+    LineKernelConfig k = kernel_config(key);
+    k.flags &= ~(uint64_t)(GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING |
+                           GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME | GPIO_V2_LINE_FLAG_EVENT_CLOCK_HTE);
+    k.debounce_us = 0;
+    return k;
+  };
 
-    auto fdOpt = request_line(chip_fd, off, event_buf_sz, debounce_us);
-    if (!fdOpt) continue;
+  std::vector<uint32_t> no_edge;  // lines whose edge-detecting request was refused
+  auto request_all = [&](uint32_t chip, const std::vector<uint32_t>& lines, bool polled) {
+    GpioBackend* backend = backends[chip].get();
+    for (size_t i = 0; i < lines.size();) {
+      std::vector<uint32_t> batch;
+      std::vector<LineKernelConfig> cfgs;
+      for (; i < lines.size() && batch.size() < batch_max; i++) {
+        const uint32_t key = line_key(chip, lines[i]);
+        cfgs.push_back(polled ? polled_config(key) : kernel_config(key));
+        if (line_attrs_needed(cfgs) > GPIO_V2_LINE_NUM_ATTRS_MAX) {
+          cfgs.pop_back();
+          break;
+        }
+        batch.push_back(lines[i]);
+      }
+      if (auto fdOpt = backend->request_lines(batch, cfgs, event_buf_sz)) {
+        add_request(chip, *fdOpt, std::move(batch), polled);
+        continue;
+      }
+      for (size_t j = 0; j < batch.size(); j++) {
+        auto fdOpt = batch.size() == 1 ? std::nullopt : backend->request_lines({batch[j]}, {cfgs[j]}, event_buf_sz);
+        if (fdOpt) add_request(chip, *fdOpt, {batch[j]}, polled);
+        else if (!polled) no_edge.push_back(batch[j]);
+      }
+    }
+  };
 
-    std::string lname = (info.name[0] ? info.name : "");
-    watched.push_back(WatchedLine{*fdOpt, off, lname});
+  for (uint32_t chip = 0; chip < num_chips; chip++) {
+    if (replaying) {
+      for (uint32_t off : eligible[chip]) watched.push_back(WatchedLine{-1, chip, off, ""});
+      continue;
+    }
+    if (!backends[chip]) continue;
+    no_edge.clear();
+    request_all(chip, eligible[chip], false);
+    if (!no_edge.empty() && gpio_poll_us > 0) request_all(chip, no_edge, true);
+  }
+  added_requests.clear();
+  for (const auto& req : requests) {
+    for (uint32_t off : req.offsets) watched.push_back(WatchedLine{req.fd, req.chip, off, line_names[line_key(req.chip, off)]});
+  }
+  size_t polled_lines = 0;
+  for (const auto& req : requests) polled_lines += req.polled ? req.offsets.size() : 0;
+  bool any_polled = polled_lines > 0;
+
+  // Mapped lines that another consumer holds are watched instead of skipped, and claimed
+  // from the loop once released. They get their dispatch slot now (req_fd -1).
+  // Lines on absent chips are set up the same way and requested when the chip attaches.
+  std::vector<uint32_t> chip_watched(num_chips, 0);  // busy lines watched per chip
+  std::sort(busy.begin(), busy.end());
+  std::sort(absent.begin(), absent.end());
+  size_t waiting_lines = 0;
+  for (uint32_t key : busy) {
+    const uint32_t chip = key_chip(key);
+    if (!backends[chip]->watch_line(key_offset(key))) continue;
+    watched.push_back(WatchedLine{-1, chip, key_offset(key), line_names[key]});
+    chip_watched[chip]++;
+    waiting_lines++;
+  }
+  for (uint32_t key : absent) {
+    watched.push_back(WatchedLine{-1, key_chip(key), key_offset(key), ""});
+    waiting_lines++;
   }
 
   I2cState i2c_state;
+  I2cSampler* i2c_sampler = nullptr;  // lives for the whole process (thread is detached)
   std::vector<AbsAxisSetup> analog_axis_setup;
-  if (!i2c_dev_path.empty()) {
+  if (replaying ? (replay.hdr->flags & kTraceHasI2c) != 0 : !i2c_dev_path.empty()) {
     i2c_state.enabled = true;
-    i2c_state.fd = xopen(i2c_dev_path, O_RDWR | O_CLOEXEC);
-    if (ioctl(i2c_state.fd, I2C_SLAVE, i2c_addr) < 0) die("I2C_SLAVE");
-    i2c_state.interval_ns = (uint64_t)std::max(1, i2c_interval_ms) * 1000000ULL;
-    i2c_state.next_poll_ns = monotonic_ns();
+    if (!replaying) {
+      if (i2c_irq_key && std::none_of(watched.begin(), watched.end(), [&](const WatchedLine& L) {
+            return line_key(L.chip, L.offset) == *i2c_irq_key;
+          })) {
+        std::cerr << "WARN: --i2c-irq line " << i2c_irq << " is not available; polling instead\n";
+        i2c_irq_key.reset();
+      }
+      i2c_sampler = new I2cSampler;
+      i2c_sampler->addr = (uint16_t)i2c_addr;
+      i2c_sampler->frame_register = i2c_frame_register;
+      i2c_sampler->word_regs = i2c_words;
+      if (battery_target != BatteryTarget::None) {
+        auto* bat = new BatteryMonitor;  // read from the sampler thread for the whole run
+        bat->target = battery_target;
+        bat->dir = !battery_dir.empty() ? battery_dir
+                   : battery_target == BatteryTarget::PowerSupply ? "/sys/class/power_supply/BAT0"
+                                                                  : "/sys/module/test_power/parameters";
+        bat->alpha = battery_alpha;
+        bat->interval_ns = (uint64_t)battery_interval_s * 1000000000ULL;
+        auto word_index = [&](uint8_t reg) {
+          auto it = std::find(i2c_sampler->word_regs.begin(), i2c_sampler->word_regs.end(), reg);
+          if (it != i2c_sampler->word_regs.end()) return (size_t)(it - i2c_sampler->word_regs.begin());
+          i2c_sampler->word_regs.push_back(reg);
+          return i2c_sampler->word_regs.size() - 1;
+        };
+        bat->mv_word = word_index(kSbsVoltage);
+        bat->soc_word = word_index(kSbsRelativeSoc);
+        i2c_sampler->battery = bat;
+        if (i2c_words.empty()) i2c_sampler->words_period_ns = bat->interval_ns;
+      }
+      i2c_sampler->interval_ns = (uint64_t)(i2c_irq_key ? i2c_watchdog_ms : i2c_interval_ms) * 1000000ULL;
+      // The watchdog behind --i2c-irq stays fixed; an idle period below the active one
+      // just turns adaptation off.
+      i2c_sampler->idle_ns = i2c_irq_key ? i2c_sampler->interval_ns
+                                         : std::max<uint64_t>((uint64_t)i2c_idle_ms * 1000000ULL, i2c_sampler->interval_ns);
+      i2c_sampler->hold_ns = (uint64_t)i2c_hold_ms * 1000000ULL;
+      i2c_sampler->cpu = i2c_cpu;
+      i2c_sampler->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      i2c_sampler->ready_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (i2c_sampler->wake_fd < 0 || i2c_sampler->ready_fd < 0) die("eventfd");
+      std::thread(i2c_sampler_main, i2c_sampler).detach();
+      const int fd = open_i2c_bus(i2c_dev_path, i2c_addr);
+      if (fd < 0) {
+        std::cerr << "WARN: waiting for " << i2c_dev_path << " to appear\n";
+      } else {
+        i2c_sampler_set_bus(*i2c_sampler, ++i2c_state.gen, fd);
+        i2c_state.attached = true;
+      }
+    }
 
-    for (const auto& kv : i2c_button_map) {
-      uint32_t pin = kv.first;
-      if (pin < 2 || pin > 13) continue;
-      uint32_t bit = pin - 2;
-      i2c_state.button_bits[bit] = I2cButtonBinding{pin, kv.second};
+    for (uint32_t bit = 0; bit < kI2cDigitalBitCount; bit++) {
+      I2cButtonBinding& b = i2c_state.button_bits[bit];
+      std::snprintf(b.origin, sizeof(b.origin), "i2c_pin=D%u", (unsigned)(bit + 2));
+      auto it = i2c_button_map.find(bit + 2);
+      if (it == i2c_button_map.end()) continue;
+      b.action = &it->second;
+      i2c_state.mapped_bits++;
     }
 
     if (!i2c_disable_axes) {
@@ -895,7 +3614,7 @@ int main(int argc, char** argv) {
     }
   }
 
-  bool have_i2c_inputs = i2c_state.enabled && (!i2c_state.button_bits.empty() || !i2c_state.analogs.empty());
+  bool have_i2c_inputs = i2c_state.enabled && (i2c_state.mapped_bits > 0 || !i2c_state.analogs.empty());
 
   if (watched.empty() && !have_i2c_inputs) {
     std::cerr << "No lines could be requested and no I2C inputs configured.\n"
@@ -912,8 +3631,11 @@ int main(int argc, char** argv) {
 
   std::set<int> gamepad_buttons;
   std::set<int> keyboard_keys;
+  std::set<int> rel_codes;
 
   auto consider_needed = [&](const Action& a) {
+    if (a.type == ActionType::Encoder) return;  // from mapping.encoders below
+    if (a.type == ActionType::I2cIrq) return;
     if (a.type == ActionType::HatDir) {
       need_gamepad = true;
       need_hat = true;
@@ -931,31 +3653,266 @@ int main(int argc, char** argv) {
   for (const auto& kv : gpio_map) consider_needed(kv.second);
   for (const auto& kv : i2c_button_map) consider_needed(kv.second);
   if (!analog_axis_setup.empty()) need_gamepad = true;
+  for (const auto& enc : mapping.encoders) {
+    if (enc.rel_code >= 0) {
+      rel_codes.insert(enc.rel_code);
+    } else {
+      consider_needed(Action{ActionType::ButtonOrKey, enc.dev, enc.key_ccw, HatDir::Up, ""});
+      consider_needed(Action{ActionType::ButtonOrKey, enc.dev, enc.key_cw, HatDir::Up, ""});
+    }
+  }
+  const bool need_relative = !rel_codes.empty();
 
   int ufd_gamepad = -1;
   int ufd_keyboard = -1;
+  int ufd_relative = -1;
 
-  if (need_gamepad) ufd_gamepad = create_uinput_gamepad(gamepad_buttons, need_hat, analog_axis_setup);
-  if (need_keyboard) ufd_keyboard = create_uinput_keyboard(keyboard_keys);
+  std::unique_ptr<OutputSink> sink;
+  switch (sink_kind) {
+    case SinkKind::Uinput: sink = std::make_unique<UinputSink>(); break;
+    case SinkKind::Null: sink = std::make_unique<NullSink>(); break;
+    case SinkKind::Fake: sink = std::make_unique<FakeSink>(); break;
+  }
+
+  if (need_gamepad) ufd_gamepad = sink->create_gamepad(gamepad_buttons, need_hat, analog_axis_setup);
+  if (need_keyboard) ufd_keyboard = sink->create_keyboard(keyboard_keys);
+  if (need_relative) ufd_relative = sink->create_relative(rel_codes);
 
-  std::cerr << "Watching " << watched.size() << " GPIO lines.\n";
-  std::cerr << "Active " << (active_low ? "LOW (FALLING=press)" : "HIGH (RISING=press)") << "\n";
-  std::cerr << "Debounce: " << debounce_us << " us (kernel attr if supported + userspace filter)\n";
+  std::string chips_label = replaying ? "replay" : "";
+  for (size_t c = 0; c < backends.size(); c++) {
+    chips_label += (c ? " + " : "") + (backends[c] ? backends[c]->describe() : chip_paths[c] + " (absent)");
+  }
+  std::cerr << "Watching " << watched.size() - waiting_lines << " GPIO lines via "
+            << requests.size() << " line request(s)"
+            << (any_polled ? " (" + std::to_string(polled_lines) + " polled, no edge detection)" : "") << " on "
+            << chips_label << ", output to " << sink->describe() << ".\n";
+  if (waiting_lines) {
+    std::cerr << "Waiting for " << waiting_lines << " line(s) that are busy or on a chip not present yet.\n";
+  }
+  std::cerr << "Active " << (active_low ? "LOW (FALLING=press)" : "HIGH (RISING=press)")
+            << (std::any_of(mapping.gpio_cfg.begin(), mapping.gpio_cfg.end(),
+                            [](const auto& kv) { return kv.second.active_low.has_value(); })
+                    ? ", overridden per line in the map" : "") << "\n";
+  std::cerr << "Debounce: " << debounce_us << " us (kernel attr if supported + userspace "
+            << debounce_strategy_name(debounce_strategy) << " filter";
+  if (!mapping.gpio_cfg.empty()) {
+    size_t overrides = 0;
+    for (const auto& kv : mapping.gpio_cfg) overrides += (kv.second.debounce || kv.second.debounce_us) ? 1 : 0;
+    if (overrides) std::cerr << ", " << overrides << " line(s) configured in the map";
+  }
+  std::cerr << ")\n";
+  auto clock_label = [](clockid_t c) {
+    return c == CLOCK_MONOTONIC ? "monotonic" : c == CLOCK_BOOTTIME ? "boottime" : "realtime";
+  };
+  std::cerr << "Event time: " << (kernel_event_time ? "kernel edge timestamp" : "write time")
+            << " (gpio clock=" << (gpio_clock_flags == GPIO_V2_LINE_FLAG_EVENT_CLOCK_HTE ? "hte" : clock_label(gpio_clock))
+            << ", uinput clock=" << clock_label(uinput_clock) << ")\n";
   if (need_gamepad) std::cerr << "Gamepad device: enabled (hat=" << (need_hat ? "yes" : "no") << ")\n";
   if (need_keyboard) std::cerr << "Keyboard device: enabled\n";
+  if (need_relative) {
+    const auto rel_encoders = std::count_if(mapping.encoders.begin(), mapping.encoders.end(),
+                                            [](const EncoderSpec& e) { return e.rel_code >= 0; });
+    std::cerr << "Relative device: enabled (" << rel_encoders << " encoder(s) in the map)\n";
+  }
   if (i2c_state.enabled) {
     char addrbuf[16];
     std::snprintf(addrbuf, sizeof(addrbuf), "0x%02X", i2c_addr & 0xFF);
     std::cerr << "I2C device: " << i2c_dev_path
               << " addr=" << addrbuf
-              << " interval=" << i2c_interval_ms << "ms"
+              << (i2c_irq_key ? " irq=" + i2c_irq + " watchdog=" + std::to_string(i2c_watchdog_ms) + "ms"
+                              : " interval=" + std::to_string(i2c_interval_ms) + "ms" +
+                                    (i2c_idle_ms > i2c_interval_ms ? ".." + std::to_string(i2c_idle_ms) + "ms" : ""))
               << " analog_axes=" << i2c_state.analogs.size()
-              << " digital_mapped=" << i2c_state.button_bits.size() << "\n";
+              << " digital_mapped=" << i2c_state.mapped_bits << "\n";
+  }
+
+  LatencyBatch lat_batch;
+  UinputFrame gamepad_frame, keyboard_frame, relative_frame;
+  gamepad_frame.fd = ufd_gamepad;
+  keyboard_frame.fd = ufd_keyboard;
+  relative_frame.fd = ufd_relative;
+  gamepad_frame.clock = keyboard_frame.clock = relative_frame.clock = uinput_clock;
+  // With --event-time kernel, a frame carries the time its input was captured (kernel edge
+  // timestamp or I2C read completion) re-expressed in the uinput clock domain. Called after
+  // staging, so a frame closed early by uinput_stage() keeps the previous input's time.
+  auto stamp_frames = [&](uint64_t ts, clockid_t src_clock) {
+    if (!kernel_event_time) return;
+    uint64_t t = clock_translate_ns(ts, src_clock, uinput_clock);
+    gamepad_frame.event_ns = t;
+    keyboard_frame.event_ns = t;
+    relative_frame.event_ns = t;
+  };
+  auto flush_frames = [&]() {
+    uinput_flush(gamepad_frame);
+    uinput_flush(keyboard_frame);
+    uinput_flush(relative_frame);
+    if (lat_batch.count) latency_commit(lat_batch, monotonic_ns());
+  };
+  auto frame_for = [&](const Action& a) -> UinputFrame* {
+    if (a.type == ActionType::I2cIrq) return nullptr;
+    if (a.dev == DeviceKind::Gamepad) return ufd_gamepad >= 0 ? &gamepad_frame : nullptr;
+    if (a.dev == DeviceKind::Relative) return ufd_relative >= 0 ? &relative_frame : nullptr;
+    return ufd_keyboard >= 0 ? &keyboard_frame : nullptr;
+  };
+
+  const Action* i2c_irq_action = i2c_irq_key ? &gpio_map.at(*i2c_irq_key) : nullptr;
+
+  // Dense dispatch table: every chip's lines, chip c starting at chip_base[c], so an
+  // event's slot is its request's base plus the kernel offset.
+  std::vector<LineSlot> line_table(total_lines);
+  std::vector<const char*> line_origin(total_lines, "");  // "offset=N name=X", for stats/logs
+  std::deque<std::string> origin_labels;                  // backing storage for the labels
+  bool need_deadlines = false;
+  uint64_t max_window_ns = 0;
+  for (const auto& L : watched) {
+    const uint32_t key = line_key(L.chip, L.offset);
+    const uint32_t idx = chip_base[L.chip] + L.offset;
+    const Action& act = gpio_map.at(key);
+    LineSlot& slot = line_table[idx];
+    slot.action = &act;
+    slot.out = frame_for(act);
+    origin_labels.push_back((L.chip ? "chip=" + std::to_string(L.chip) + " " : std::string()) +
+                            "offset=" + std::to_string(L.offset) +
+                            " name=" + (L.name.empty() ? "-" : L.name));
+    line_origin[idx] = origin_labels.back().c_str();
+    if (act.type == ActionType::Encoder) {
+      slot.debounce = DebounceStrategy::None;  // linked to its encoder below
+      continue;
+    }
+
+    LineConfig cfg = line_config(key);
+    slot.active_low = cfg.active_low.value_or(active_low);
+    slot.tap = cfg.edges.value_or(LineEdges::Both) != LineEdges::Both;
+    slot.debounce = cfg.debounce.value_or(debounce_strategy);
+    slot.window_ns = (uint32_t)((uint64_t)cfg.debounce_us.value_or(debounce_us) * 1000ULL);  // <= kMaxDebounceUs
+    if (slot.tap) slot.debounce = DebounceStrategy::Lockout;  // no level to settle on
+    if (slot.window_ns == 0) slot.debounce = DebounceStrategy::None;
+    if (slot.debounce == DebounceStrategy::Settle || slot.debounce == DebounceStrategy::Integrator) {
+      need_deadlines = true;
+    }
+    max_window_ns = std::max<uint64_t>(max_window_ns, slot.window_ns);
+  }
+  for (size_t r = 0; r < requests.size(); r++) {
+    for (size_t bit = 0; bit < requests[r].offsets.size(); bit++) {
+      LineSlot& slot = line_table[requests[r].base + requests[r].offsets[bit]];
+      slot.req = (uint16_t)r;
+      slot.req_bit = (uint8_t)bit;
+    }
+  }
+  for (auto& b : i2c_state.button_bits) {
+    if (b.action) b.out = frame_for(*b.action);
+  }
+
+  // Encoders: both channel slots point at one table entry. An encoder whose lines were
+  // not both set up (out of range, excluded, remapped) stays inert.
+  std::vector<Encoder> encoders(mapping.encoders.size());
+  std::vector<uint16_t> enc_dirty;  // encoders with detents in the current batch
+  enc_dirty.reserve(encoders.size());
+  std::vector<const char*> encoder_origin(encoders.size(), "");
+  auto key_label = [](uint32_t key) {
+    return (key_chip(key) ? "chip" + std::to_string(key_chip(key)) + ":" : std::string()) +
+           std::to_string(key_offset(key));
+  };
+  for (size_t e = 0; e < encoders.size(); e++) {
+    const EncoderSpec& spec = mapping.encoders[e];
+    origin_labels.push_back("encoder=" + key_label(spec.key_a) + "+" + key_label(spec.key_b));
+    encoder_origin[e] = origin_labels.back().c_str();
+    bool linked = true;
+    uint32_t idx[2];
+    for (int ch = 0; ch < 2; ch++) {
+      const uint32_t key = ch ? spec.key_b : spec.key_a;
+      const uint32_t chip = key_chip(key);
+      idx[ch] = chip < num_chips && key_offset(key) < chip_lines[chip] ? chip_base[chip] + key_offset(key) : 0;
+      const Action* act = chip < num_chips && key_offset(key) < chip_lines[chip] ? line_table[idx[ch]].action : nullptr;
+      linked &= act && act->type == ActionType::Encoder && act->code == (int)e;
+    }
+    if (!linked) {
+      std::cerr << "WARN: " << encoder_origin[e] << " is not active (both lines must be watched)\n";
+      continue;
+    }
+    Encoder& enc = encoders[e];
+    enc.spec = &spec;
+    enc.out = spec.rel_code >= 0 ? frame_for(Action{ActionType::Encoder, DeviceKind::Relative, 0, HatDir::Up, ""})
+                                 : frame_for(Action{ActionType::ButtonOrKey, spec.dev, 0, HatDir::Up, ""});
+    enc.line_a = idx[0];
+    line_table[idx[0]].enc = line_table[idx[1]].enc = (uint16_t)e;
+  }
+
+  if (bench_dispatch_edges > 0) {
+    std::vector<std::pair<uint32_t, uint32_t>> lines;  // (line_key, line_table index)
+    for (const auto& L : watched) lines.emplace_back(line_key(L.chip, L.offset), chip_base[L.chip] + L.offset);
+    if (lines.empty()) die("--bench-dispatch: no watched lines");
+    bench_dispatch(line_table, gpio_map, lines, std::max<uint64_t>(1000, (uint64_t)debounce_us * 1000ULL),
+                   bench_dispatch_edges);
+    return 0;
+  }
+
+  // Per-source latency histograms, allocated up front so recording never allocates.
+  std::deque<SourceLatency> latency_sources;
+  if (latency_stats) {
+    auto new_source = [&](const char* label) {
+      latency_sources.emplace_back();
+      latency_sources.back().label = label;
+      return &latency_sources.back();
+    };
+    for (size_t off = 0; off < line_table.size(); off++) {
+      const Action* act = line_table[off].action;
+      if (act && act->type != ActionType::I2cIrq && line_table[off].enc == kNoIndex) {
+        line_table[off].lat = new_source(line_origin[off]);
+      }
+    }
+    for (auto& b : i2c_state.button_bits) {
+      if (b.action) b.lat = new_source(b.origin);
+    }
+    for (auto& axis : i2c_state.analogs) {
+      origin_labels.push_back("i2c_axis=" + axis.label);
+      axis.lat = new_source(origin_labels.back().c_str());
+    }
   }
 
-  // Userspace debounce state: last accepted event timestamp per offset
-  const uint64_t debounce_ns = (uint64_t)debounce_us * 1000ULL;
-  std::unordered_map<uint32_t, uint64_t> last_accept_ns;
+  // Event log: register every record source, then hand the ring to the writer thread.
+  auto* logger = new EventLogger;  // lives for the whole process (the input thread pushes to it)
+  logger->format = log_format;
+  if (log_format != LogFormat::None && !log_path.empty()) {
+    logger->out = std::fopen(log_path.c_str(), log_format == LogFormat::Binary ? "wb" : "w");
+    if (!logger->out) die("open log file: " + log_path);
+    std::setvbuf(logger->out, nullptr, _IONBF, 0);  // the writer already batches into chunks
+  }
+  auto dev_label = [](const Action& a) -> const char* {
+    if (a.type == ActionType::HatDir) return nullptr;
+    return a.dev == DeviceKind::Gamepad ? "gamepad" : a.dev == DeviceKind::Relative ? "relative" : "keyboard";
+  };
+  for (size_t e = 0; e < encoders.size(); e++) {
+    const EncoderSpec& spec = mapping.encoders[e];
+    encoders[e].log_src = log_add_source(*logger, encoder_origin[e], spec.token.c_str(),
+                                         dev_label(Action{ActionType::Encoder, spec.dev, 0, HatDir::Up, ""}));
+  }
+  for (size_t off = 0; off < line_table.size(); off++) {
+    LineSlot& slot = line_table[off];
+    if (slot.action && slot.enc == kNoIndex) {
+      slot.log_src = log_add_source(*logger, line_origin[off], slot.action->token.c_str(), dev_label(*slot.action));
+    }
+  }
+  for (auto& b : i2c_state.button_bits) {
+    b.log_src = b.action ? log_add_source(*logger, b.origin, b.action->token.c_str(), dev_label(*b.action))
+                         : log_add_source(*logger, b.origin, nullptr, nullptr);
+  }
+  for (auto& axis : i2c_state.analogs) {
+    axis.log_src = log_add_source(*logger, axis.label.c_str(), nullptr, nullptr);
+  }
+  std::vector<uint16_t> i2c_word_log_src;  // parallel to --i2c-words
+  for (uint8_t reg : i2c_words) {
+    char label[24];
+    std::snprintf(label, sizeof(label), "i2c_reg=0x%02X", reg);
+    origin_labels.push_back(label);
+    i2c_word_log_src.push_back(log_add_source(*logger, origin_labels.back().c_str(), nullptr, nullptr));
+  }
+  std::thread log_thread;
+  if (log_format != LogFormat::None) {
+    logger->wake.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (logger->wake.fd < 0) die("eventfd");
+    log_thread = std::thread(log_writer_main, logger);
+  }
 
   // Hat state (pressed directions)
   bool hat_up=false, hat_down=false, hat_left=false, hat_right=false;
@@ -968,15 +3925,14 @@ int main(int argc, char** argv) {
     x = std::max(-1, std::min(1, x));
     y = std::max(-1, std::min(1, y));
     if (x != last_hat_x || y != last_hat_y) {
-      uinput_abs(ufd_gamepad, ABS_HAT0X, x);
-      uinput_abs(ufd_gamepad, ABS_HAT0Y, y);
-      uinput_syn(ufd_gamepad);
+      uinput_stage(gamepad_frame, EV_ABS, ABS_HAT0X, x);
+      uinput_stage(gamepad_frame, EV_ABS, ABS_HAT0Y, y);
       last_hat_x = x;
       last_hat_y = y;
     }
   };
 
-  auto emit_action = [&](const Action& act, bool press, uint64_t ts, const std::string& origin_desc) {
+  auto emit_action = [&](const Action& act, UinputFrame* out, bool press, uint64_t ts, uint16_t log_src) {
     if (act.type == ActionType::HatDir) {
       switch (act.hat_dir) {
         case HatDir::Up:    hat_up    = press; break;
@@ -986,66 +3942,131 @@ int main(int argc, char** argv) {
       }
       recompute_hat();
     } else {
-      int outfd = (act.dev == DeviceKind::Gamepad) ? ufd_gamepad : ufd_keyboard;
-      if (outfd >= 0) uinput_key(outfd, act.code, press);
+      if (out) uinput_stage(*out, EV_KEY, (uint16_t)act.code, press ? 1 : 0);
     }
 
-    std::cout << "t_ns=" << ts << " " << origin_desc
-              << " token=" << act.token
-              << " -> " << (press ? "DOWN" : "UP");
+    LogRecord r{};
+    r.t_ns = ts;
+    r.kind = LogKind::Action;
+    r.flags = (uint8_t)((press ? kLogPress : 0) | (act.type == ActionType::HatDir ? kLogHat : 0));
+    r.hat_x = (int8_t)last_hat_x;
+    r.hat_y = (int8_t)last_hat_y;
+    r.source = log_src;
+    r.code = act.code;
+    log_push(*logger, r);
+  };
 
-    if (act.type == ActionType::HatDir) {
-      std::cout << " (hat x=" << last_hat_x << " y=" << last_hat_y << ")";
-    } else {
-      std::cout << " (dev=" << (act.dev == DeviceKind::Gamepad ? "gamepad" : "keyboard")
-                << " code=" << act.code << ")";
-    }
-    std::cout << "\n";
-    std::cout.flush();
+  // --bench-debounce: reports and added latency of the strategy under test. Added latency
+  // runs from the edge that last moved a line away from its reported state to the report
+  // (the deadline, for reports made when one expires).
+  struct DebounceBench {
+    uint64_t reports = 0;
+    LatencyHistogram added;
+    std::vector<uint64_t> away_ns;  // per line_table index, 0 = at the reported state
+  };
+  DebounceBench* debounce_bench = nullptr;
+  auto debounce_bench_report = [&](uint32_t off, uint64_t report_ns) {
+    uint64_t& away = debounce_bench->away_ns[off];
+    debounce_bench->reports++;
+    latency_record(debounce_bench->added, away && report_ns > away ? report_ns - away : 0);
+    away = 0;
   };
 
-  std::vector<pollfd> pfds(watched.size());
-  for (size_t i = 0; i < watched.size(); i++) {
-    pfds[i].fd = watched[i].req_fd;
-    pfds[i].events = POLLIN;
-    pfds[i].revents = 0;
+  TimerWheel wheel;
+  wheel.now_tick = monotonic_ns() >> kWheelTickShift;
+  int deadline_fd = -1;  // replay expires deadlines on its own virtual clock
+  if (!replaying && need_deadlines) {
+    deadline_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (deadline_fd < 0) die("timerfd_create");
   }
+  uint64_t deadline_armed_ns = 0;
 
-  std::vector<gpio_v2_line_event> evbuf(128);
-  std::vector<uint16_t> i2c_raw(kI2cAnalogValueCount);
+  EventLoop loop;
+  event_loop_init(loop, loop_backend);
+  for (auto& req : requests) {
+    if (!req.polled) event_loop_add(loop, &req.source);
+  }
+  std::deque<ChipWatch> chip_watches;  // one per chip; registered while it has busy lines
+  for (uint32_t c = 0; c < num_chips; c++) {
+    chip_watches.push_back(ChipWatch{c, EventSource{SourceKind::LineInfo, -1, nullptr}});
+    chip_watches.back().source.ctx = &chip_watches.back();
+    if (!chip_watched[c]) continue;
+    chip_watches.back().waiting = chip_watched[c];
+    chip_watches.back().source.fd = backends[c]->info_fd();
+    chip_watches.back().registered = true;
+    event_loop_add(loop, &chip_watches.back().source);
+  }
 
-  auto handle_i2c = [&]() {
-    if (!i2c_state.enabled) return;
-    uint8_t buf[kI2cFrameBytes];
-    ssize_t n = ::read(i2c_state.fd, buf, sizeof(buf));
-    if (n != (ssize_t)sizeof(buf)) {
-      if (!i2c_state.read_error_logged) {
-        std::cerr << "WARN: I2C read failed (got " << n << " bytes)\n";
-        i2c_state.read_error_logged = true;
+  // SIGUSR1 dumps runtime statistics; SIGINT/SIGTERM stop the loop so simulated
+  // backends can tear down what they created.
+  int sig_fd = ::signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sig_fd < 0) die("signalfd");
+  EventSource sig_source{SourceKind::Signal, sig_fd, nullptr};
+  event_loop_add(loop, &sig_source);
+  EventSource deadline_source{SourceKind::Timer, deadline_fd, nullptr};
+  if (deadline_fd >= 0) event_loop_add(loop, &deadline_source);
+  EventSource i2c_source{SourceKind::I2cFrames, i2c_sampler ? i2c_sampler->ready_fd : -1, nullptr};
+  if (i2c_sampler) event_loop_add(loop, &i2c_source);
+
+  uint64_t overflow_resyncs = 0;
+  auto dump_stats = [&]() {
+    std::fprintf(stderr, "event log: dropped=%llu\n",
+                 (unsigned long long)logger->dropped.load(std::memory_order_relaxed));
+    std::fprintf(stderr, "gpio: overflow resyncs=%llu\n", (unsigned long long)overflow_resyncs);
+    if (i2c_sampler) {
+      std::fprintf(stderr, "i2c: frames=%llu dropped=%llu read_errors=%llu period_us=%llu\n",
+                   (unsigned long long)i2c_sampler->frames.load(std::memory_order_relaxed),
+                   (unsigned long long)i2c_sampler->dropped.load(std::memory_order_relaxed),
+                   (unsigned long long)i2c_sampler->read_errors.load(std::memory_order_relaxed),
+                   (unsigned long long)(i2c_sampler->period_ns.load(std::memory_order_relaxed) / 1000));
+      if (const BatteryMonitor* bat = i2c_sampler->battery) {
+        std::fprintf(stderr, "battery: %u mV soc=%d%% -> %s\n", bat->last_mv.load(std::memory_order_relaxed),
+                     (int)bat->last_soc.load(std::memory_order_relaxed), bat->dir.c_str());
       }
-      return;
     }
-    i2c_state.read_error_logged = false;
+    if (latency_stats) latency_dump(latency_sources);
+    else std::fprintf(stderr, "latency report: not enabled (start with --latency-stats)\n");
+  };
+  std::vector<EventSource*> ready;
+  ready.reserve(std::max<size_t>(32, requests.size()));
 
+  std::vector<gpio_v2_line_event> evbuf(128);
+  std::vector<uint16_t> i2c_raw(kI2cAnalogValueCount);
+
+  TraceWriter* recorder = nullptr;
+  std::thread trace_thread;
+  if (!record_path.empty()) {
+    recorder = trace_open_writer(record_path, gpio_clock, i2c_state.enabled);
+    trace_thread = std::thread(trace_writer_main, recorder);
+  }
+  // Lets both writers drain, flush and exit; the capture is closed so no record is lost.
+  auto stop_writers = [&]() {
+    writer_stop(logger->wake, log_thread);
+    if (!recorder) return;
+    writer_stop(recorder->wake, trace_thread);
+    std::fclose(recorder->out);
+    recorder = nullptr;
+  };
+
+  // Decodes one I2C frame (live or replayed) and emits the resulting report.
+  auto process_i2c_frame = [&](const uint8_t* buf, uint64_t poll_start_ns, uint64_t read_done_ns) {
     for (size_t i = 0; i < kI2cAnalogValueCount; i++) {
       i2c_raw[i] = get_u16_le(&buf[i * 2]);
     }
     uint16_t mask = get_u16_le(&buf[kI2cAnalogValueCount * 2]);
 
-    std::string analog_log;
     if (i2c_log_samples) {
-      std::cout << "i2c_raw=";
-      for (size_t i = 0; i < kI2cAnalogValueCount; i++) {
-        if (i) std::cout << ",";
-        std::cout << i2c_raw[i];
-      }
-      std::cout << " dmask=0x" << std::hex << mask << std::dec << "\n";
-      analog_log.reserve(i2c_state.analogs.size() * 48);
+      LogRecord r{};
+      r.t_ns = read_done_ns;
+      r.kind = LogKind::I2cRaw;
+      for (size_t i = 0; i < kI2cAnalogValueCount; i++) r.v[i] = i2c_raw[i];
+      r.v[5] = mask;
+      log_push(*logger, r);
     }
 
-    bool analog_changed = false;
     if (!i2c_state.analogs.empty() && ufd_gamepad >= 0) {
-      for (auto& axis : i2c_state.analogs) {
+      for (size_t ai = 0; ai < i2c_state.analogs.size(); ai++) {
+        auto& axis = i2c_state.analogs[ai];
         if (axis.raw_index >= kI2cAnalogValueCount) continue;
         uint16_t sample = i2c_raw[axis.raw_index];
 
@@ -1079,134 +4100,823 @@ int main(int argc, char** argv) {
         else if (scaled > 100) scaled = 100;
 
         if (i2c_log_samples) {
-          char buf[128];
-          std::snprintf(buf, sizeof(buf),
-                        " %s raw=%u min=%u max=%u span=%u scaled=%d",
-                        axis.label.c_str(),
-                        (unsigned)sample,
-                        (unsigned)axis.min_seen,
-                        (unsigned)axis.max_seen,
-                        (unsigned)span,
-                        scaled);
-          analog_log.append(buf);
+          LogRecord r{};
+          r.t_ns = read_done_ns;
+          r.kind = LogKind::I2cAxis;
+          r.flags = (uint8_t)((ai == 0 ? kLogFirst : 0) |
+                              (ai + 1 == i2c_state.analogs.size() ? kLogLast : 0));
+          r.source = axis.log_src;
+          r.v[0] = sample;
+          r.v[1] = axis.min_seen;
+          r.v[2] = axis.max_seen;
+          r.v[3] = span;
+          r.v[4] = (uint16_t)scaled;
+          log_push(*logger, r);
         }
 
         if (scaled != axis.last_scaled) {
-          uinput_abs(ufd_gamepad, axis.abs_code, scaled);
+          uinput_stage(gamepad_frame, EV_ABS, axis.abs_code, scaled);
           axis.last_scaled = scaled;
-          analog_changed = true;
-        }
-      }
-      if (analog_changed) uinput_syn(ufd_gamepad);
-      if (i2c_log_samples) {
-        if (!analog_log.empty()) {
-          std::cout << "i2c_axes:" << analog_log << "\n";
+          if (axis.lat) latency_note(lat_batch, axis.lat, poll_start_ns, read_done_ns, monotonic_ns());
         }
-        std::cout.flush();
       }
-    } else if (i2c_log_samples) {
-      std::cout.flush();
     }
 
     uint16_t changed = i2c_state.have_mask ? (mask ^ i2c_state.last_mask) : 0;
     i2c_state.last_mask = mask;
     i2c_state.have_mask = true;
     if (changed) {
-      for (uint32_t bit = 0; bit < 12; ++bit) {
+      for (uint32_t bit = 0; bit < kI2cDigitalBitCount; ++bit) {
         if (!(changed & (1u << bit))) continue;
         bool level_high = (mask & (1u << bit)) != 0;
         bool press = active_low ? !level_high : level_high;
         uint64_t ts = monotonic_ns();
-        uint32_t pin = bit + 2;
-        std::string origin = "i2c_pin=D" + std::to_string(pin);
-
-        auto it = i2c_state.button_bits.find(bit);
-        if (it == i2c_state.button_bits.end()) {
-          std::cout << "t_ns=" << ts << " " << origin
-                    << " (unmapped) -> " << (press ? "DOWN" : "UP") << "\n";
-          std::cout.flush();
+
+        const I2cButtonBinding& b = i2c_state.button_bits[bit];
+        if (!b.action) {
+          LogRecord r{};
+          r.t_ns = ts;
+          r.kind = LogKind::Unmapped;
+          r.flags = press ? kLogPress : 0;
+          r.source = b.log_src;
+          log_push(*logger, r);
+          continue;
+        }
+        emit_action(*b.action, b.out, press, ts, b.log_src);
+        if (b.lat) latency_note(lat_batch, b.lat, poll_start_ns, read_done_ns, monotonic_ns());
+      }
+    }
+    stamp_frames(read_done_ns, CLOCK_MONOTONIC);
+    flush_frames();  // axes + digital pins of this poll go out as one report
+  };
+
+  // Frames queued by the sampler thread. The eventfd is cleared before the mailbox is
+  // drained, so a frame pushed meanwhile raises it again and is not stranded.
+  auto handle_i2c = [&]() {
+    uint64_t queued;
+    (void)!::read(i2c_sampler->ready_fd, &queued, sizeof(queued));
+    i2c_sampler->mailbox.drain([&](const I2cSample& smp) {
+      if (smp.gen != i2c_state.gen) return;  // read before the bus was detached
+      trace_push(recorder, smp.read_done_ns, TraceType::I2cFrame, smp.bytes, sizeof(smp.bytes),
+                 (uint32_t)std::min<uint64_t>(smp.read_done_ns - smp.poll_start_ns, UINT32_MAX));
+      process_i2c_frame(smp.bytes, smp.poll_start_ns, smp.read_done_ns);
+      for (size_t w = 0; w < smp.nwords && w < i2c_word_log_src.size(); w++) {  // battery words not logged
+        LogRecord r{};
+        r.t_ns = smp.read_done_ns;
+        r.kind = LogKind::I2cWord;
+        r.source = i2c_word_log_src[w];
+        r.code = smp.words[w];
+        log_push(*logger, r);
+      }
+    });
+  };
+
+  // One channel edge of an encoder: advance the AB state and count detents. Output waits
+  // for encoder_flush() at the end of the batch.
+  auto encoder_edge = [&](uint16_t e, uint32_t idx, bool high, uint64_t edge_ns) {
+    Encoder& enc = encoders[e];
+    const uint8_t bit = idx == enc.line_a ? 2 : 1;
+    const uint8_t ab = high ? (uint8_t)(enc.ab | bit) : (uint8_t)(enc.ab & ~bit);
+    const int8_t step = kQuadStep[(enc.ab << 2) | ab];
+    enc.ab = ab;
+    if (!step) return;
+    enc.acc = (int8_t)(enc.acc + step);
+    if (enc.acc > -enc.spec->steps && enc.acc < enc.spec->steps) return;
+    const int dir = enc.acc > 0 ? 1 : -1;
+    enc.acc = 0;
+    // Velocity: a detent that follows the previous one within kEncoderAccelRefNs counts
+    // ref/dt times, up to the encoder's accel limit.
+    const uint64_t dt = edge_ns - enc.last_detent_ns;
+    int mult = 1;
+    if (enc.spec->accel > 1 && dt < kEncoderAccelRefNs) {
+      mult = (int)std::min<uint64_t>(enc.spec->accel, kEncoderAccelRefNs / std::max<uint64_t>(dt, 1));
+    }
+    enc.last_detent_ns = edge_ns;
+    enc.pending += dir * mult;
+    if (!enc.dirty) {
+      enc.dirty = true;
+      enc_dirty.push_back(e);
+    }
+  };
+  auto encoder_flush = [&](uint64_t ts) {
+    for (uint16_t e : enc_dirty) {
+      Encoder& enc = encoders[e];
+      enc.dirty = false;
+      if (!enc.pending || !enc.out) continue;
+      const EncoderSpec& spec = *enc.spec;
+      if (spec.rel_code >= 0) {
+        uinput_stage(*enc.out, EV_REL, (uint16_t)spec.rel_code, enc.pending);
+      } else {
+        const uint16_t code = (uint16_t)(enc.pending > 0 ? spec.key_cw : spec.key_ccw);
+        for (int i = std::min(std::abs(enc.pending), kEncoderMaxPulses); i > 0; i--) {
+          uinput_stage(*enc.out, EV_KEY, code, 1);
+          uinput_stage(*enc.out, EV_KEY, code, 0);
+        }
+      }
+      if (kernel_event_time) enc.out->event_ns = clock_translate_ns(ts, gpio_clock, uinput_clock);
+      LogRecord r{};
+      r.t_ns = ts;
+      r.kind = LogKind::Encoder;
+      r.source = enc.log_src;
+      r.code = enc.pending;
+      log_push(*logger, r);
+      enc.pending = 0;
+    }
+    enc_dirty.clear();
+  };
+
+  // Runs one read() worth of edges (live or replayed) through debounce, mapping and
+  // emission. `lat_edge_shift` re-aligns edge timestamps with read_ns for latency
+  // accounting when replaying; it is 0 for live input.
+  // `base` is the line_table index of the reporting chip's offset 0.
+  auto process_gpio_events = [&](const gpio_v2_line_event* evs, size_t cnt, uint32_t base,
+                                 uint64_t read_ns, int64_t lat_edge_shift) {
+    uint64_t last_enc_ts = 0;
+    for (size_t k = 0; k < cnt; k++) {
+      const auto& e = evs[k];
+      uint32_t off = base + e.offset;
+      if (off >= line_table.size()) continue;
+      LineSlot& slot = line_table[off];
+      if (!slot.action) continue;
+
+      bool is_rising  = (e.id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+      bool is_falling = (e.id == GPIO_V2_LINE_EVENT_FALLING_EDGE);
+      if (!is_rising && !is_falling) continue;
+
+      const uint64_t ts = e.timestamp_ns;
+      const uint64_t edge_ns = clock_translate_ns(ts, gpio_clock, CLOCK_MONOTONIC);
+      if (slot.enc != kNoIndex) {
+        encoder_edge(slot.enc, off, is_rising, edge_ns);
+        last_enc_ts = ts;
+        continue;
+      }
+      if (slot.action == i2c_irq_action) {  // data ready: the sampler reads the frame now
+        if (i2c_sampler) i2c_sampler_kick(*i2c_sampler, edge_ns);
+        continue;
+      }
+      const bool press = slot.active_low ? is_falling : is_rising;
+      const bool in_window = slot.have_accept && edge_ns >= slot.last_accept_ns &&
+                             (edge_ns - slot.last_accept_ns) < slot.window_ns;
+      slot.level_press = press;
+      if (debounce_bench && !slot.tap) {
+        uint64_t& away = debounce_bench->away_ns[off];
+        away = press == slot.pressed ? 0 : away ? away : edge_ns;
+      }
+
+      if (slot.tap) {
+        // Single-edge line: the requested edge is the whole gesture.
+        if (slot.debounce == DebounceStrategy::Lockout && in_window) continue;
+        slot.last_accept_ns = edge_ns;
+        slot.have_accept = true;
+        emit_action(*slot.action, slot.out, true, ts, slot.log_src);
+        emit_action(*slot.action, slot.out, false, ts, slot.log_src);
+        stamp_frames(ts, gpio_clock);
+        if (slot.lat) latency_note(lat_batch, slot.lat, edge_ns + lat_edge_shift, read_ns, monotonic_ns());
+        continue;
+      }
+
+      switch (slot.debounce) {
+        case DebounceStrategy::None:
+          break;
+        case DebounceStrategy::Lockout:
+          // Drop edges too close together on the same GPIO.
+          if (in_window) continue;
+          break;
+        case DebounceStrategy::Settle:
+          // A change outside any window is reported at once; an edge inside one (bounce)
+          // only pushes the deadline, and the level is confirmed when it expires.
+          if (in_window || slot.deadline_ns != 0) {
+            deadline_arm(line_table, wheel, (uint16_t)off, edge_ns + slot.window_ns);
+            continue;
+          }
+          if (press == slot.pressed) continue;  // no change since the last report
+          break;
+        case DebounceStrategy::Integrator:
+          // Edges only start sampling; the counter decides on the deadlines.
+          if (slot.deadline_ns == 0) {
+            deadline_arm(line_table, wheel, (uint16_t)off, edge_ns + slot.window_ns / kIntegratorSteps);
+          }
           continue;
+      }
+      slot.pressed = press;
+      slot.last_accept_ns = edge_ns;
+      slot.have_accept = true;
+      if (debounce_bench) debounce_bench_report(off, edge_ns);
+
+      emit_action(*slot.action, slot.out, press, ts, slot.log_src);
+      stamp_frames(ts, gpio_clock);
+      if (slot.lat) latency_note(lat_batch, slot.lat, edge_ns + lat_edge_shift, read_ns, monotonic_ns());
+    }
+    if (!enc_dirty.empty()) encoder_flush(last_enc_ts);
+    flush_frames();  // every edge from this read() goes out as one report per device
+  };
+
+  // Debounce deadlines that expired by `now_ns`. Settle: the line has been quiet for a
+  // full window, so its real level is read and reported if it differs from the last
+  // report. Integrator: one sample moves the counter; it is reported on saturation and
+  // sampling continues until the counter agrees with the level.
+  auto deadline_expire = [&](uint64_t now_ns) {
+    wheel_advance(line_table, wheel, now_ns, [&](uint16_t off, uint64_t deadline_ns) {
+      LineSlot& slot = line_table[off];
+
+      bool press = slot.level_press;  // fallback: the level implied by the last edge
+      if (slot.req != kNoIndex) {
+        gpio_v2_line_values vals{};
+        vals.mask = 1ULL << slot.req_bit;
+        const LineRequest& req = requests[slot.req];
+        if (backends[req.chip]->get_values(req.fd, vals)) {
+          bool high = (vals.bits & vals.mask) != 0;
+          press = slot.active_low ? !high : high;
+        }
+      }
+
+      uint64_t edge_ns = deadline_ns;
+      if (slot.debounce == DebounceStrategy::Integrator) {
+        if (press && slot.integ < kIntegratorSteps) slot.integ++;
+        else if (!press && slot.integ > 0) slot.integ--;
+        if (slot.integ != (press ? kIntegratorSteps : 0)) {
+          deadline_arm(line_table, wheel, off, deadline_ns + slot.window_ns / kIntegratorSteps);
+        }
+        if (slot.integ == kIntegratorSteps) press = true;
+        else if (slot.integ == 0) press = false;
+        else return;
+      } else {
+        edge_ns = deadline_ns - slot.window_ns;  // settle: when the line went quiet
+      }
+      if (press == slot.pressed) {
+        if (debounce_bench && slot.deadline_ns == 0) debounce_bench->away_ns[off] = 0;  // settled unchanged
+        return;
+      }
+      slot.pressed = press;
+      if (debounce_bench) debounce_bench_report(off, deadline_ns);
+
+      slot.last_accept_ns = edge_ns;
+      const uint64_t ts = clock_translate_ns(edge_ns, CLOCK_MONOTONIC, gpio_clock);
+      emit_action(*slot.action, slot.out, press, ts, slot.log_src);
+      stamp_frames(ts, gpio_clock);
+      if (slot.lat) latency_note(lat_batch, slot.lat, edge_ns, now_ns, monotonic_ns());
+    });
+    flush_frames();
+  };
+
+  // Reads the levels of every line in a request with one GET_VALUES and reports each line
+  // whose level disagrees with the last report, all in one frame. Pending debounce work is
+  // dropped: the snapshot is the new truth. Used at startup and after an event overflow.
+  auto resync_request = [&](LineRequest& req) {
+    gpio_v2_line_values vals{};
+    vals.mask = req.offsets.size() == 64 ? ~0ULL : ((1ULL << req.offsets.size()) - 1);
+    if (!backends[req.chip]->get_values(req.fd, vals)) return;
+    req.last_bits = vals.bits;
+    const uint64_t now_ns = monotonic_ns();
+    const uint64_t ts = clock_translate_ns(now_ns, CLOCK_MONOTONIC, gpio_clock);
+    for (size_t bit = 0; bit < req.offsets.size(); bit++) {
+      const uint16_t off = (uint16_t)(req.base + req.offsets[bit]);
+      LineSlot& slot = line_table[off];
+      if (!slot.action) continue;
+      const bool high = (vals.bits >> bit) & 1;
+      if (slot.action == i2c_irq_action) {  // still asserted: a frame is waiting
+        if (!high && i2c_sampler) i2c_sampler_kick(*i2c_sampler, now_ns);
+        continue;
+      }
+      if (slot.tap) continue;
+      if (slot.enc != kNoIndex) {  // encoders only track the channel level
+        Encoder& enc = encoders[slot.enc];
+        const uint8_t ch = off == enc.line_a ? 2 : 1;
+        enc.ab = high ? (uint8_t)(enc.ab | ch) : (uint8_t)(enc.ab & ~ch);
+        enc.acc = 0;
+        continue;
+      }
+      const bool press = slot.active_low ? !high : high;
+      slot.level_press = press;
+      slot.integ = press ? kIntegratorSteps : 0;
+      deadline_cancel(line_table, wheel, (uint16_t)off);
+      if (press == slot.pressed) continue;
+      slot.pressed = press;
+      slot.last_accept_ns = now_ns;
+      slot.have_accept = true;
+      emit_action(*slot.action, slot.out, press, ts, slot.log_src);
+      stamp_frames(ts, gpio_clock);
+    }
+    flush_frames();
+  };
+
+  // Returns false if the chip went away (ENODEV); the caller detaches it.
+  auto drain_line_request = [&](LineRequest& req) {
+    while (req.fd >= 0) {
+      ssize_t n = read(req.fd, evbuf.data(), evbuf.size() * sizeof(gpio_v2_line_event));
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno == ENODEV) return false;
+        die("read(gpio event)");
+      }
+      if (n == 0) break;
+      const uint64_t read_ns = (latency_stats || recorder) ? monotonic_ns() : 0;
+
+      size_t cnt = (size_t)n / sizeof(gpio_v2_line_event);
+      bool gap = false;
+      for (size_t k = 0; k < cnt; k++) {
+        gap |= evbuf[k].seqno != req.last_seqno + 1;
+        req.last_seqno = evbuf[k].seqno;
+      }
+      for (size_t k = 0; k < cnt && recorder; k++) {
+        trace_push(recorder, read_ns, TraceType::GpioEvent, &evbuf[k], sizeof(gpio_v2_line_event), req.chip);
+      }
+      process_gpio_events(evbuf.data(), cnt, req.base, read_ns, 0);
+      if (gap) {
+        // The kernel FIFO overflowed and dropped edges: reconcile with the real levels.
+        overflow_resyncs++;
+        resync_request(req);
+      }
+    }
+    return true;
+  };
+
+  // Polled fallback: one GET_VALUES per request per tick, XOR against the last sample, and
+  // feed each changed bit through the edge pipeline as a synthesized event stamped with the
+  // sample time. The rate is fast for a while after any change and slow when idle.
+  uint64_t gpio_poll_next_ns = monotonic_ns();
+  uint64_t gpio_poll_active_until_ns = 0;
+  auto poll_gpio = [&](uint64_t now_ns) {
+    for (auto& req : requests) {
+      if (!req.polled) continue;
+      gpio_v2_line_values vals{};
+      vals.mask = req.offsets.size() == 64 ? ~0ULL : ((1ULL << req.offsets.size()) - 1);
+      if (!backends[req.chip]->get_values(req.fd, vals)) continue;
+      const uint64_t changed = (vals.bits ^ req.last_bits) & vals.mask;
+      if (!changed) continue;
+      req.last_bits = vals.bits;
+      gpio_poll_active_until_ns = now_ns + kGpioPollHoldNs;
+
+      const uint64_t ts = clock_translate_ns(now_ns, CLOCK_MONOTONIC, gpio_clock);
+      uint64_t wanted = (changed & vals.bits & req.rising_mask) | (changed & ~vals.bits & req.falling_mask);
+      size_t cnt = 0;
+      while (wanted) {
+        const unsigned bit = (unsigned)__builtin_ctzll(wanted);
+        wanted &= wanted - 1;
+        gpio_v2_line_event& e = evbuf[cnt++];
+        std::memset(&e, 0, sizeof(e));
+        e.timestamp_ns = ts;
+        e.id = ((vals.bits >> bit) & 1) ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+        e.offset = req.offsets[bit];
+        e.seqno = ++req.last_seqno;
+      }
+      for (size_t k = 0; k < cnt && recorder; k++) {
+        trace_push(recorder, now_ns, TraceType::GpioEvent, &evbuf[k], sizeof(gpio_v2_line_event), req.chip);
+      }
+      process_gpio_events(evbuf.data(), cnt, req.base, now_ns, 0);
+    }
+    const uint32_t us = now_ns < gpio_poll_active_until_ns ? gpio_poll_us : std::max(gpio_poll_us, gpio_poll_idle_us);
+    gpio_poll_next_ns = now_ns + (uint64_t)us * 1000ULL;
+  };
+
+  // Hooks a request created after startup into dispatch: slots, loop, current level.
+  auto activate_request = [&](size_t r) {
+    LineRequest& req = requests[r];
+    if (r >= kNoIndex) die("too many line requests");
+    for (size_t bit = 0; bit < req.offsets.size(); bit++) {
+      LineSlot& slot = line_table[req.base + req.offsets[bit]];
+      slot.req = (uint16_t)r;
+      slot.req_bit = (uint8_t)bit;
+    }
+    if (req.polled) any_polled = true;
+    else event_loop_add(loop, &req.source);
+    resync_request(req);
+  };
+  auto watch_start = [&](uint32_t chip) {
+    ChipWatch& w = chip_watches[chip];
+    if (w.registered) return;
+    w.source.fd = backends[chip]->info_fd();
+    event_loop_add(loop, &w.source);
+    w.registered = true;
+  };
+  auto watch_stop = [&](uint32_t chip) {
+    ChipWatch& w = chip_watches[chip];
+    w.waiting = 0;
+    if (!w.registered) return;
+    event_loop_del(loop, &w.source);
+    w.registered = false;
+  };
+
+  // Line-info changes on a chip with busy mapped lines. When one of them is released, it
+  // gets a request of its own (or a polled one if edges are refused), joins the loop, and
+  // its current level is reported. Once the last one is claimed the chip leaves the loop.
+  // Returns true if a line was claimed.
+  std::vector<gpio_v2_line_info_changed> info_buf(16);
+  auto handle_line_info = [&](ChipWatch& w) {
+    if (!w.registered) return false;
+    ssize_t n = ::read(w.source.fd, info_buf.data(), info_buf.size() * sizeof(gpio_v2_line_info_changed));
+    if (n <= 0) return false;
+    bool claimed = false;
+    for (size_t k = 0; k < (size_t)n / sizeof(gpio_v2_line_info_changed); k++) {
+      const gpio_v2_line_info& info = info_buf[k].info;
+      const uint32_t idx = chip_base[w.chip] + info.offset;
+      if (info.offset >= chip_lines[w.chip] || !line_table[idx].action || line_table[idx].req != kNoIndex) continue;
+      if (info_buf[k].event_type == GPIO_V2_LINE_CHANGED_REQUESTED) continue;
+      if (info.flags & (GPIO_V2_LINE_FLAG_USED | GPIO_V2_LINE_FLAG_OUTPUT)) continue;
+
+      const uint32_t key = line_key(w.chip, info.offset);
+      GpioBackend* backend = backends[w.chip].get();
+      bool polled = false;
+      auto fdOpt = backend->request_lines({info.offset}, {kernel_config(key)}, event_buf_sz);
+      if (!fdOpt && gpio_poll_us > 0) {
+        fdOpt = backend->request_lines({info.offset}, {polled_config(key)}, event_buf_sz);
+        polled = true;
+      }
+      if (!fdOpt) {
+        std::cerr << "WARN: released line " << line_origin[idx] << " could not be requested\n";
+        continue;
+      }
+      backend->unwatch_line(info.offset);
+      const size_t r = add_request(w.chip, *fdOpt, {info.offset}, polled);
+      added_requests.clear();
+      std::cerr << "Claimed released line " << line_origin[idx] << (polled ? " (polled)" : "") << "\n";
+      activate_request(r);
+      claimed = true;
+      if (w.waiting > 0 && --w.waiting == 0) {
+        watch_stop(w.chip);
+        break;
+      }
+    }
+    return claimed;
+  };
+
+  // A chip node appeared (or became accessible): open it and request its mapped lines the
+  // way startup does; busy ones are watched.
+  auto attach_chip = [&](uint32_t chip) {
+    if (backends[chip]) return false;
+    backends[chip] = ChardevBackend::try_open(chip_paths[chip]);
+    if (!backends[chip]) return false;  // e.g. udev has not set permissions yet: IN_ATTRIB retries
+    GpioBackend* backend = backends[chip].get();
+    std::vector<uint32_t> free_lines;
+    uint32_t busy_lines = 0;
+    for (uint32_t off = 0; off < chip_lines[chip]; off++) {
+      if (!line_table[chip_base[chip] + off].action) continue;
+      auto info = backend->line_info(off);
+      if (!info) continue;
+      if ((info->flags & (GPIO_V2_LINE_FLAG_USED | GPIO_V2_LINE_FLAG_OUTPUT)) || info->consumer[0]) {
+        busy_lines += backend->watch_line(off) ? 1 : 0;
+        continue;
+      }
+      free_lines.push_back(off);
+    }
+    added_requests.clear();
+    no_edge.clear();
+    request_all(chip, free_lines, false);
+    if (!no_edge.empty() && gpio_poll_us > 0) request_all(chip, no_edge, true);
+    size_t lines = 0;
+    for (size_t r : added_requests) {
+      activate_request(r);
+      lines += requests[r].offsets.size();
+    }
+    added_requests.clear();
+    if (busy_lines > 0) {
+      watch_start(chip);
+      chip_watches[chip].waiting = busy_lines;
+    }
+    std::cerr << "Attached " << backend->describe() << ": watching " << lines << " line(s)\n";
+    return true;
+  };
+
+  // A chip node went away: drop its requests and report every held line as released so
+  // no button stays stuck down.
+  auto detach_chip = [&](uint32_t chip) {
+    if (!backends[chip]) return false;
+    for (size_t r = 0; r < requests.size(); r++) {
+      LineRequest& req = requests[r];
+      if (req.chip != chip || req.fd < 0) continue;
+      if (!req.polled) event_loop_del(loop, &req.source);
+      ::close(req.fd);
+      req.fd = -1;
+      req.polled = false;
+      free_requests.push_back(r);  // reattaching the chip reuses the entry
+    }
+    const uint64_t ts = clock_translate_ns(monotonic_ns(), CLOCK_MONOTONIC, gpio_clock);
+    for (uint32_t off = 0; off < chip_lines[chip]; off++) {
+      const uint16_t idx = (uint16_t)(chip_base[chip] + off);
+      LineSlot& slot = line_table[idx];
+      if (!slot.action) continue;
+      deadline_cancel(line_table, wheel, idx);
+      slot.req = kNoIndex;
+      slot.integ = 0;
+      slot.have_accept = false;
+      slot.level_press = false;
+      if (!slot.pressed) continue;
+      slot.pressed = false;
+      emit_action(*slot.action, slot.out, false, ts, slot.log_src);
+      stamp_frames(ts, gpio_clock);
+    }
+    flush_frames();
+    watch_stop(chip);
+    std::cerr << "Detached " << chip_paths[chip] << "\n";
+    backends[chip].reset();
+    return true;
+  };
+
+  auto attach_i2c = [&]() {
+    if (!i2c_sampler || i2c_state.attached) return false;
+    const int fd = open_i2c_bus(i2c_dev_path, i2c_addr);
+    if (fd < 0) return false;
+    i2c_sampler_set_bus(*i2c_sampler, ++i2c_state.gen, fd);
+    i2c_state.attached = true;
+    std::cerr << "Attached I2C bus " << i2c_dev_path << "\n";
+    return true;
+  };
+  auto detach_i2c = [&]() {
+    if (!i2c_state.attached) return false;
+    i2c_sampler_set_bus(*i2c_sampler, ++i2c_state.gen, -1);  // the sampler closes the fd
+    i2c_state.attached = false;
+    const uint64_t ts = monotonic_ns();
+    for (uint32_t bit = 0; i2c_state.have_mask && bit < kI2cDigitalBitCount; bit++) {
+      const I2cButtonBinding& b = i2c_state.button_bits[bit];
+      const bool high = (i2c_state.last_mask >> bit) & 1;
+      if (b.action && (active_low ? !high : high)) emit_action(*b.action, b.out, false, ts, b.log_src);
+    }
+    i2c_state.have_mask = false;
+    stamp_frames(ts, CLOCK_MONOTONIC);
+    flush_frames();
+    std::cerr << "Detached I2C bus " << i2c_dev_path << "\n";
+    return true;
+  };
+
+  // Hotplug: inotify on the directories that hold the configured chips and I2C bus. A
+  // node that appears (or whose permissions change) is attached; one that goes away is
+  // detached. Names are compared in place so unrelated /dev traffic does not allocate.
+  struct HotplugTarget {
+    int wd;
+    std::string name;  // basename inside the watched directory
+    int chip;          // index into chip_paths, or -1 for the I2C bus
+  };
+  std::vector<HotplugTarget> hotplug_targets;
+  int hotplug_fd = -1;
+  if (!replaying) {
+    auto add_target = [&](const std::string& path, int chip) {
+      const size_t slash = path.rfind('/');
+      const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+      if (hotplug_fd < 0) hotplug_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (hotplug_fd < 0) die("inotify_init1");
+      int wd = ::inotify_add_watch(hotplug_fd, dir.c_str(),
+                                   IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM);
+      if (wd < 0) {
+        std::cerr << "WARN: cannot watch " << dir << " for hotplug (" << std::strerror(errno) << ")\n";
+        return;
+      }
+      hotplug_targets.push_back(HotplugTarget{wd, path.substr(slash + 1), chip});
+    };
+    if (backend_kind == BackendKind::Chardev) {
+      for (uint32_t c = 0; c < num_chips; c++) add_target(chip_paths[c], (int)c);
+    }
+    if (i2c_state.enabled) add_target(i2c_dev_path, -1);
+  }
+  EventSource hotplug_source{SourceKind::Hotplug, hotplug_fd, nullptr};
+  if (hotplug_fd >= 0) event_loop_add(loop, &hotplug_source);
+  for (uint32_t c = 0; c < num_chips && !replaying && backend_kind == BackendKind::Chardev; c++) {
+    attach_chip(c);  // appeared between the startup probe and the watch
+  }
+  if (!replaying) attach_i2c();
+
+  alignas(inotify_event) char hotplug_buf[4096];
+  auto handle_hotplug = [&]() {
+    bool changed = false;
+    for (;;) {
+      ssize_t n = ::read(hotplug_fd, hotplug_buf, sizeof(hotplug_buf));
+      if (n <= 0) break;
+      for (ssize_t pos = 0; pos < n;) {
+        const auto* ev = reinterpret_cast<const inotify_event*>(hotplug_buf + pos);
+        pos += (ssize_t)(sizeof(inotify_event) + ev->len);
+        if (ev->len == 0) continue;
+        const bool gone = ev->mask & (IN_DELETE | IN_MOVED_FROM);
+        for (const auto& t : hotplug_targets) {
+          if (t.wd != ev->wd || t.name != ev->name) continue;
+          if (t.chip >= 0) changed |= gone ? detach_chip((uint32_t)t.chip) : attach_chip((uint32_t)t.chip);
+          else changed |= gone ? detach_i2c() : attach_i2c();
         }
-        emit_action(it->second.action, press, ts, origin);
       }
     }
+    return changed;
   };
 
-  while (true) {
+  // Pinned only now, so the writer threads started above keep floating over all CPUs.
+  if (input_cpu >= 0) pin_thread_to_cpu(input_cpu, "input thread");
+
+  if (replaying) {
+    // One pass over the capture. Keep the capture's spacing between inputs: shift every
+    // timestamp by one constant so debounce windows see exactly the recorded deltas, at
+    // either replay speed.
+    struct ReplayStats {
+      size_t gpio_events = 0, i2c_frames = 0;
+      uint64_t elapsed_ns = 0, cpu_ns = 0;
+    };
+    auto replay_pass = [&](bool paced, bool with_i2c) {
+      ReplayStats st;
+      const uint64_t t0 = replay.count ? replay.records[0].t_ns : 0;
+      const uint64_t base_ns = monotonic_ns();
+      const uint64_t cpu_base_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+      const int64_t shift = (int64_t)base_ns - (int64_t)t0;
+
+      for (size_t i = 0; i < replay.count;) {
+        const TraceRecord& rec = replay.records[i];
+        if (paced) {
+          uint64_t due = rec.t_ns + shift;
+          timespec ts{(time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL)};
+          while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+        }
+        const uint64_t now = monotonic_ns();
+        const uint64_t virtual_read_ns = rec.t_ns + shift;
+        deadline_expire(virtual_read_ns);  // deadlines follow the capture's clock, not the wall
+
+        if (rec.type == TraceType::GpioEvent) {
+          // Consecutive events with the same read time came from one read() batch. The
+          // record's aux names the chip (0 in single-chip captures).
+          size_t cnt = 0;
+          const uint32_t chip = rec.aux;
+          while (i < replay.count && cnt < evbuf.size() && replay.records[i].type == TraceType::GpioEvent &&
+                 replay.records[i].t_ns == rec.t_ns && replay.records[i].aux == chip) {
+            std::memcpy(&evbuf[cnt], replay.records[i].payload, sizeof(gpio_v2_line_event));
+            evbuf[cnt].timestamp_ns += shift;
+            cnt++;
+            i++;
+          }
+          st.gpio_events += cnt;
+          if (chip < num_chips) {
+            process_gpio_events(evbuf.data(), cnt, chip_base[chip], now, (int64_t)now - (int64_t)virtual_read_ns);
+          }
+        } else if (rec.type == TraceType::I2cFrame && with_i2c && i2c_state.enabled && rec.len == kI2cFrameBytes) {
+          process_i2c_frame(rec.payload, now - rec.aux, now);
+          st.i2c_frames++;
+          i++;
+        } else {
+          i++;
+        }
+      }
+
+      deadline_expire(UINT64_MAX);
+      st.elapsed_ns = monotonic_ns() - base_ns;
+      st.cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_base_ns;
+      return st;
+    };
+
+    if (bench_debounce) {
+      // Every strategy over the same GPIO events, at max speed and from the same idle
+      // state. Each line keeps its own window; only its strategy is replaced. Tap lines,
+      // encoders and the data-ready line keep theirs. I2C frames are skipped.
+      DebounceBench bench;
+      bench.away_ns.assign(line_table.size(), 0);
+      debounce_bench = &bench;
+      std::fprintf(stderr, "replay: debounce strategies over %zu records, windows from --debounce-us and the map\n",
+                   replay.count);
+      for (DebounceStrategy d : {DebounceStrategy::Settle, DebounceStrategy::Lockout,
+                                 DebounceStrategy::Integrator, DebounceStrategy::None}) {
+        wheel = TimerWheel();
+        wheel.now_tick = monotonic_ns() >> kWheelTickShift;
+        for (LineSlot& slot : line_table) {
+          if (!slot.action) continue;
+          slot.deadline_ns = 0;
+          slot.dl_prev = slot.dl_next = kNoIndex;
+          slot.last_accept_ns = 0;
+          slot.have_accept = slot.pressed = slot.level_press = false;
+          slot.integ = 0;
+          if (slot.enc == kNoIndex && !slot.tap && slot.action != i2c_irq_action && slot.window_ns) slot.debounce = d;
+        }
+        for (Encoder& enc : encoders) {
+          enc.ab = 0;
+          enc.acc = 0;
+          enc.pending = 0;
+          enc.last_detent_ns = 0;
+        }
+        hat_up = hat_down = hat_left = hat_right = false;
+        last_hat_x = last_hat_y = 0;
+        bench.reports = 0;
+        bench.added = LatencyHistogram{};
+        std::fill(bench.away_ns.begin(), bench.away_ns.end(), 0);
+
+        const ReplayStats st = replay_pass(false, false);
+        std::fprintf(stderr,
+                     "replay: %-10s %zu edges -> %llu reports, %.0f ns cpu/edge, "
+                     "added latency (us) p50=%.1f p99=%.1f max=%.1f\n",
+                     debounce_strategy_name(d), st.gpio_events, (unsigned long long)bench.reports,
+                     st.gpio_events ? (double)st.cpu_ns / (double)st.gpio_events : 0.0,
+                     latency_percentile(bench.added, 0.50) / 1000.0, latency_percentile(bench.added, 0.99) / 1000.0,
+                     bench.added.max / 1000.0);
+      }
+      debounce_bench = nullptr;
+      stop_writers();
+      return 0;
+    }
+
+    const ReplayStats st = replay_pass(!replay_max_speed, true);
+    const double elapsed_s = (double)st.elapsed_ns / 1e9;
+    const uint64_t inputs = st.gpio_events + st.i2c_frames;
+    std::fprintf(stderr, "replay: %zu GPIO events, %zu I2C frames in %.3f s (%.0f inputs/s, %.0f ns cpu/input)\n",
+                 st.gpio_events, st.i2c_frames, elapsed_s,
+                 elapsed_s > 0 ? (double)inputs / elapsed_s : 0.0,
+                 inputs ? (double)st.cpu_ns / (double)inputs : 0.0);
+    stop_writers();
+    dump_stats();
+    return 0;
+  }
+
+  // Lines already held at startup produce no edge until they change: report them now.
+  for (auto& req : requests) resync_request(req);
+
+  if (bench_iterations > 0) {
+    BenchConfig cfg;
+    for (const auto& L : watched) {
+      const Action& act = gpio_map.at(line_key(L.chip, L.offset));
+      const LineSlot& slot = line_table[chip_base[L.chip] + L.offset];
+      if (act.type != ActionType::ButtonOrKey || !frame_for(act) || slot.tap || slot.req == kNoIndex) continue;
+      cfg.reader_fd = sink->open_reader(act.dev);
+      if (cfg.reader_fd < 0) die("--bench: output sink cannot be observed (use --sink uinput|fake)");
+      cfg.backend = backends[L.chip].get();
+      cfg.offset = L.offset;
+      cfg.code = act.code;
+      cfg.active_low = slot.active_low;
+      break;
+    }
+    if (cfg.reader_fd < 0) die("--bench: no watched line maps to a button or key");
+    cfg.spacing_ns = 2ULL * max_window_ns + 100000ULL;  // integrator reports a window late
+    cfg.iterations = bench_iterations;
+    std::thread(bench_main, cfg).detach();
+  }
+
+  bool running = true;
+  while (running) {
+#ifdef GPIO_TO_UINPUT_ALLOC_CHECK
+    const unsigned long allocs_before = g_alloc_count;
+#endif
+    bool reconfigured = false;  // claiming a line allocates; that is not the event path
+    // Per-line deadlines: the timerfd follows the wheel's next expiry (0 disarms it).
+    const uint64_t wheel_ns = wheel_next_ns(wheel);
+    if (wheel_ns != deadline_armed_ns) {
+      timerfd_arm_abs(deadline_fd, wheel_ns);
+      deadline_armed_ns = wheel_ns;
+    }
+
     int timeout_ms = -1;
-    if (i2c_state.enabled) {
+    uint64_t due_ns = UINT64_MAX;
+    if (any_polled) due_ns = gpio_poll_next_ns;
+    if (due_ns != UINT64_MAX) {
       uint64_t now = monotonic_ns();
-      if (now >= i2c_state.next_poll_ns) {
+      if (now >= due_ns) {
         timeout_ms = 0;
       } else {
-        uint64_t delta_ns = i2c_state.next_poll_ns - now;
+        uint64_t delta_ns = due_ns - now;
         timeout_ms = (int)std::min<uint64_t>(delta_ns / 1000000ULL, (uint64_t)INT_MAX);
         if (timeout_ms == 0 && delta_ns > 0) timeout_ms = 1;
       }
     }
 
-    int r = poll(pfds.data(), pfds.size(), timeout_ms);
-    if (r < 0) {
-      if (errno == EINTR) continue;
-      die("poll()");
-    }
-    if (r > 0) {
-      for (size_t i = 0; i < pfds.size(); i++) {
-        if (!(pfds[i].revents & POLLIN)) continue;
-
-        while (true) {
-          ssize_t n = read(pfds[i].fd, evbuf.data(), evbuf.size() * sizeof(gpio_v2_line_event));
-          if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            die("read(gpio event)");
-          }
-          if (n == 0) break;
-
-          size_t cnt = (size_t)n / sizeof(gpio_v2_line_event);
-          for (size_t k = 0; k < cnt; k++) {
-            const auto& e = evbuf[k];
-            uint32_t off = e.offset;
-
-            auto it = gpio_map.find(off);
-            if (it == gpio_map.end()) continue;
-
-            bool is_rising  = (e.id == GPIO_V2_LINE_EVENT_RISING_EDGE);
-            bool is_falling = (e.id == GPIO_V2_LINE_EVENT_FALLING_EDGE);
-            if (!is_rising && !is_falling) continue;
-
-            // Userspace debounce: drop edges too close together on the same GPIO.
-            uint64_t ts = e.timestamp_ns;
-            auto lt = last_accept_ns.find(off);
-            if (debounce_ns > 0 && lt != last_accept_ns.end()) {
-              if (ts >= lt->second && (ts - lt->second) < debounce_ns) {
-                continue;
-              }
-            }
-            last_accept_ns[off] = ts;
-
-            bool press = active_low ? is_falling : is_rising;
-
-            const Action& act = it->second;
-            std::string nm("-");
-            for (const auto& L : watched) {
-              if (L.offset == off && !L.name.empty()) { nm = L.name; break; }
-            }
-
-            std::string origin = "offset=" + std::to_string(off) + " name=" + nm;
-            emit_action(act, press, ts, origin);
+    if (!event_loop_wait(loop, timeout_ms, ready)) continue;
+    for (EventSource* src : ready) {
+      switch (src->kind) {
+        case SourceKind::GpioRequest: {
+          auto& req = *static_cast<LineRequest*>(src->ctx);
+          if (!drain_line_request(req)) reconfigured |= detach_chip(req.chip);
+          break;
+        }
+        case SourceKind::LineInfo:
+          reconfigured |= handle_line_info(*static_cast<ChipWatch*>(src->ctx));
+          break;
+        case SourceKind::Hotplug:
+          reconfigured |= handle_hotplug();
+          break;
+        case SourceKind::Signal: {
+          signalfd_siginfo si;
+          while (::read(src->fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+            if (si.ssi_signo == SIGUSR1) dump_stats();
+            else running = false;
           }
+          break;
+        }
+        case SourceKind::I2cFrames:
+          handle_i2c();
+          break;
+        case SourceKind::Timer: {
+          uint64_t expirations;
+          while (::read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {}
+          deadline_armed_ns = 0;  // a fired timerfd is disarmed
+          deadline_expire(monotonic_ns());
+          break;
         }
       }
     }
 
-    if (i2c_state.enabled) {
+    if (any_polled) {
       uint64_t now = monotonic_ns();
-      if (now >= i2c_state.next_poll_ns) {
-        handle_i2c();
-        i2c_state.next_poll_ns = now + i2c_state.interval_ns;
-      }
+      if (now >= gpio_poll_next_ns) poll_gpio(now);
     }
+#ifdef GPIO_TO_UINPUT_ALLOC_CHECK
+    if (!reconfigured && g_alloc_count != allocs_before) {
+      std::fprintf(stderr, "ALLOC_CHECK: %lu heap allocation(s) on the event path\n",
+                   g_alloc_count - allocs_before);
+      std::abort();
+    }
+#endif
   }
 
+  for (const auto& req : requests) {
+    if (req.fd >= 0) ::close(req.fd);
+  }
+  stop_writers();
+  if (latency_stats) dump_stats();
   return 0;
 }